@@ -1,7 +1,11 @@
-from flask import Flask, request, send_file
+from flask import Flask, Response, request, send_file
 from flask_cors import CORS
 from codegen.cpp_parse import *
+from codegen.cost_model import estimatePatch, checkBudget, UnknownBlockCostError
 from compile import *
+from compile_queue import CompileQueue, QueueFull, DONE, FAILED
+from firmware_cache import FirmwareCache
+from workspace_reaper import startReaper
 import json
 import io
 import uuid
@@ -9,32 +13,178 @@ import uuid
 
 app = Flask(__name__)
 CORS(app)
+firmwareCache = FirmwareCache()
+compileQueue = CompileQueue()
+startReaper(os.path.join(os.getcwd(), 'buildspace'), compileQueue.isActive)
 
-@app.route("/compiler", methods=['POST'])
-def getBinary():
+"""
+Generates and compiles the firmware of a graph, runs on a worker of the compileQueue.
+Reports the codegen, patch or compile and link phases, the output of make and the compiler diagnostics
+(with the id of the node they refer to, if any) as events of the job.
+Returns the content of Main.bin, which is also put into the firmwareCache.
+"""
+def buildFirmware(data, reqId, cacheKey, job, makeJobs):
+    job.addEvent('phase', 'codegen')
     try:
-        data = request.get_json()
-        reqId = uuid.uuid4() 
-        
+        paramValues = genCpp(data, reqId)
+    except Exception as e:
+        app.logger.error(e)
+        # traceback.print_stack()
+        job.addEvent('diagnostic', {'severity': 'error', 'message': str(e), 'nodeId': None})
+        raise Exception("Error")
+
+    current_directory = os.getcwd()
+    sourcePath = os.path.join(current_directory, 'buildspace', rf'{str(reqId)}', 'Main.cpp')
+
+    # Main.cpp does not hold the parameters, if a binary of the same Main.cpp is cached, its parameter table is patched instead of compiling
+    profile = bool(data.get('profile'))
+    topologyKey = firmwareCache.getTopologyKey(sourcePath, profile)
+    topologyBinary = firmwareCache.get(topologyKey)
+    if topologyBinary is not None:
+        job.addEvent('phase', 'patch')
         try:
-            genCpp(data, reqId)
+            binary = patchParamTable(topologyBinary, paramValues)
+            firmwareCache.putBinary(cacheKey, binary)
+            return binary
         except Exception as e:
             app.logger.error(e)
-            # traceback.print_stack()
-            return "Error", 404
-        
-        compile(reqId)
 
-        current_directory = os.getcwd()
-        final_directory = os.path.join(current_directory, 'buildspace', rf'{str(reqId)}', 'build')
-        filename = f'{final_directory}/' + os.path.basename("Main.bin")
+    lineBlocks = getSourceLineBlocks(sourcePath, data['blocks'])
+
+    def onOutput(line):
+        if isLinkCommand(line):
+            job.addEvent('phase', 'link')
+        diagnostic = parseDiagnostic(line)
+        if diagnostic is not None:
+            diagnostic['nodeId'] = lineBlocks.get(diagnostic['line']) if diagnostic['file'] == 'Main.cpp' else None
+            job.addEvent('diagnostic', diagnostic)
+        job.addEvent('output', line)
+
+    job.addEvent('phase', 'compile')
+    compile(reqId, makeJobs, onOutput, profile)
 
-        if not os.path.exists(filename):
-            return "Build failed", 404
+    final_directory = os.path.join(current_directory, 'buildspace', rf'{str(reqId)}', 'build')
+    filename = f'{final_directory}/' + os.path.basename("Main.bin")
 
-        return send_file(filename, as_attachment=True)
+    if not os.path.exists(filename):
+        raise Exception("Build failed")
+
+    firmwareCache.put(cacheKey, filename)
+    firmwareCache.put(topologyKey, filename)
+    with open(filename, 'rb') as f:
+        return f.read()
+
+"""
+Queues the compilation of the posted graph, unless it is cached. Returns the job,
+a tuple of a response for a graph that cannot be parsed, (422 with the ids of its nodes) for a cycle in the graph
+or a block the cost model does not know,
+(422 with the estimate) for a graph over the budget of the cost model or (429 with Retry-After) when the queue is full.
+The estimate is attached to the job, budget warnings are its first diagnostics.
+"""
+def submitJob(data):
+    reqId = uuid.uuid4()
+    try:
+        cacheKey = firmwareCache.getKey(data)
+        estimate = estimatePatch(data)
+    except (RoutingCycleError, UnknownBlockCostError) as e:
+        return {'error': str(e), 'nodeIds': e.nodeIds}, 422
+    except Exception as e:
+        app.logger.error(e)
+        return "Error", 404
+
+    errors, warnings = checkBudget(estimate)
+    if errors:
+        return {'error': ' '.join(errors), 'estimate': estimate}, 422
+
+    binary = firmwareCache.get(cacheKey)
+    if binary is not None:
+        job = compileQueue.addFinished(reqId, binary, estimate)
+    else:
+        try:
+            job = compileQueue.submit(reqId, lambda job, makeJobs: buildFirmware(data, reqId, cacheKey, job, makeJobs), estimate)
+        except QueueFull as e:
+            return str(e), 429, {'Retry-After': str(e.retryAfter)}
+    for message in warnings:
+        job.addEvent('diagnostic', {'severity': 'warning', 'message': message, 'nodeId': None})
+    return job
+
+def sendBinary(job):
+    return send_file(io.BytesIO(job.result), as_attachment=True, download_name="Main.bin")
+
+# Compiles the posted graph and responds with the binary once it is built
+@app.route("/compiler", methods=['POST'])
+def getBinary():
+    try:
+        job = submitJob(request.get_json())
+        if isinstance(job, tuple):
+            return job
+        job.done.wait()
+        if job.status == FAILED:
+            return job.error, 404
+        response = sendBinary(job)
+        response.headers['X-Patch-Estimate'] = json.dumps(job.estimate)
+        return response
     except Exception as e:
         return str(e)
 
+# Queues the posted graph and responds with the job, follow it with GET /jobs/<id>/events or poll GET /jobs/<id>
+@app.route("/jobs", methods=['POST'])
+def postJob():
+    job = submitJob(request.get_json())
+    if isinstance(job, tuple):
+        return job
+    return job.toDict(), 202
+
+@app.route("/jobs/<jobId>", methods=['GET'])
+def getJob(jobId):
+    job = compileQueue.getJob(jobId)
+    if job is None:
+        return "Unknown job", 404
+    return job.toDict()
+
+"""
+Server-sent events of a job: every event recorded by buildFirmware, then a final "status" event with the job itself.
+A comment is sent every KEEPALIVE_SECONDS, so proxies do not close the connection during a long build.
+"""
+KEEPALIVE_SECONDS = 15
+
+def streamJobEvents(job):
+    sent = 0
+    while True:
+        finished = job.done.is_set()
+        events = job.waitForEvents(sent, KEEPALIVE_SECONDS)
+        for event, eventData in events:
+            yield f"event: {event}\ndata: {json.dumps(eventData)}\n\n"
+        sent += len(events)
+        if finished and not events:
+            yield f"event: status\ndata: {json.dumps(job.toDict())}\n\n"
+            return
+        if not events:
+            yield ": keepalive\n\n"
+
+@app.route("/jobs/<jobId>/events", methods=['GET'])
+def getJobEvents(jobId):
+    job = compileQueue.getJob(jobId)
+    if job is None:
+        return "Unknown job", 404
+    return Response(streamJobEvents(job), mimetype='text/event-stream', headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
+
+@app.route("/jobs/<jobId>/binary", methods=['GET'])
+def getJobBinary(jobId):
+    job = compileQueue.getJob(jobId)
+    if job is None or job.status == FAILED:
+        return "Unknown job" if job is None else job.error, 404
+    if job.status != DONE:
+        return job.toDict(), 409
+    return sendBinary(job)
+
+@app.route("/cache", methods=['GET'])
+def getCacheStats():
+    return firmwareCache.getStats()
+
+@app.route("/queue", methods=['GET'])
+def getQueueStats():
+    return compileQueue.getStats()
+
 if __name__ == '__main__':
-    app.run(host="0.0.0.0", port=5000)
\ No newline at end of file
+    app.run(host="0.0.0.0", port=5000, threaded=True)
@@ -0,0 +1,339 @@
+#include "DspBlock.h"
+#include "bench_util.h"
+
+/**   @brief DspBlock benchmarks
+ *    Times handle() of every DspBlock for a range of block sizes and input kinds.
+ *    Builds for the host (make -C ../host bench) and for the Seed (make in this folder).
+ *
+ *    The result is printed as a tab separated table, one line per block/input/block size:
+ *    - ns_per_sample:  average processing time per sample
+ *    - cycles_per_sample: the same in CPU cycles (NA on the host)
+ *    - min/avg/max_load: share of the block period at SAMPLE_RATE used by one instance, over the same
+ *                        handle() calls as ns_per_sample
+ *    - per_callback: how many instances fit in one callback of that block size
+ *    - max_error: largest difference of output 0 to a scalar reference implementation, relative to
+ *                 max(1, |reference|) (NA for blocks without reference)
+ *    - object_bytes: sizeof the block
+ *
+ *    Every handle() call is timed on its own, without the overhead of reading the timer (see TimerOverhead).
+ *    The output of the Seed is the calibration table of the code generator's cost model (codegen/cost_model.py).
+ */
+
+using namespace daisy;
+using namespace dspblock;
+
+static BenchHelper hw;
+static Dubby       dubby;
+
+/* Test cases */
+static constexpr size_t block_list[] = {16, 32, 64, 128, 256, 512};
+
+static constexpr float  SAMPLE_RATE   = 48000.f;
+static constexpr size_t MAX_INPUTS    = 7;
+static constexpr size_t SIGNAL_LENGTH = 48000; /* one second of audio per case */
+
+/* Memory buffers, one input signal per port */
+static float DSY_SDRAM_BSS signals[MAX_INPUTS][SIGNAL_LENGTH];
+
+/* How the input ports are driven */
+enum InputKind
+{
+    INPUT_CONSTANT, /* the same value for the whole run, like ConstValue */
+    INPUT_KNOB,     /* a new value every block, like KnobMap */
+    INPUT_AUDIO,    /* a new value every sample */
+    INPUT_LAST
+};
+
+static const char* InputKindStrings[INPUT_LAST] = {"constant", "knob", "audio"};
+
+/* Range of sensible values for an input port */
+struct InputRange
+{
+    float min;
+    float max;
+    bool  discrete; /* only min or max, e.g. triggers */
+};
+
+struct BenchCase
+{
+    const char* name;
+    size_t objectBytes; /* sizeof the block, without what it allocates */
+    DspBlock* (*create)(int bufferLength);
+    size_t numInputs;
+    InputRange   ports[MAX_INPUTS];
+    float (*reference)(const float* in); /* one output sample from one sample of every input, optional */
+};
+
+static constexpr InputRange AUDIO   = {-1.f, 1.f, false};
+static constexpr InputRange UNIT    = {0.f, 1.f, false};
+static constexpr InputRange TRIGGER = {0.f, 1.f, true};
+static constexpr InputRange CUTOFF  = {20.f, 20000.f, false};
+static constexpr InputRange QUALITY = {0.7f, 10.f, false};
+
+/* Scalar references for the vectorized math blocks, see DspKernels.h */
+static float RefMultiply(const float* in)
+{
+    return in[0] * in[1];
+}
+static float RefSum(const float* in)
+{
+    return in[0] + in[1];
+}
+static float RefSub(const float* in)
+{
+    return in[0] - in[1];
+}
+static float RefDiv(const float* in)
+{
+    return in[0] / in[1];
+}
+static float RefScaler(const float* in)
+{
+    return (((in[0] - 0.f) * (2000.f - 20.f)) / (1.f - 0.f)) + 20.f;
+}
+static float RefUnipolariser(const float* in)
+{
+    return fabsf(in[0]);
+}
+static float RefVolumeControl(const float* in)
+{
+    return in[1] * in[0];
+}
+static float RefMix(const float* in)
+{
+    return (in[0] + in[1]) / 2.f;
+}
+
+static const BenchCase cases[] = {
+    {"KnobMap", sizeof(KnobMap), [](int n) -> DspBlock* { return new KnobMap(dubby, 0, n); }, 0, {}},
+    {"DubbyKnobs", sizeof(DubbyKnobs), [](int n) -> DspBlock* { return new DubbyKnobs(dubby, n); }, 0, {}},
+    {"ConstValue", sizeof(ConstValue), [](int n) -> DspBlock* { return new ConstValue(1.f, n); }, 0, {}},
+    {"Clock", sizeof(Clock), [](int n) -> DspBlock* { return new Clock(n); }, 1, {{1.f, 20.f, false}}},
+    {"Osc", sizeof(Osc), [](int n) -> DspBlock* { return new Osc(n); }, 1, {{20.f, 2000.f, false}}},
+    {"ADSREnv",
+     sizeof(ADSREnv),
+     [](int n) -> DspBlock* { return new ADSREnv(n); },
+     5,
+     {TRIGGER, {0.001f, 0.5f, false}, {0.001f, 0.5f, false}, UNIT, {0.001f, 1.f, false}}},
+    {"FeedbackDelay", sizeof(FeedbackDelay), [](int n) -> DspBlock* { return new FeedbackDelay(4800, n); }, 2, {AUDIO, UNIT}},
+    {"BlockDelay", sizeof(BlockDelay), [](int n) -> DspBlock* { return new BlockDelay(n); }, 1, {AUDIO}},
+    {"NMultiplier", sizeof(NMultiplier), [](int n) -> DspBlock* { return new NMultiplier(2, n); }, 2, {AUDIO, AUDIO}, RefMultiply},
+    {"Sum", sizeof(Sum), [](int n) -> DspBlock* { return new Sum(2, n); }, 2, {AUDIO, AUDIO}, RefSum},
+    {"Sub", sizeof(Sub), [](int n) -> DspBlock* { return new Sub(2, n); }, 2, {AUDIO, AUDIO}, RefSub},
+    {"Div", sizeof(Div), [](int n) -> DspBlock* { return new Div(2, n); }, 2, {AUDIO, {0.5f, 2.f, false}}, RefDiv},
+    {"Scaler", sizeof(Scaler), [](int n) -> DspBlock* { return new Scaler(0.f, 1.f, 20.f, 2000.f, n); }, 1, {UNIT}, RefScaler},
+    {"Unipolariser", sizeof(Unipolariser), [](int n) -> DspBlock* { return new Unipolariser(n); }, 1, {AUDIO}, RefUnipolariser},
+    {"VolumeControl", sizeof(VolumeControl), [](int n) -> DspBlock* { return new VolumeControl(n); }, 2, {UNIT, AUDIO}, RefVolumeControl},
+    {"Mix", sizeof(Mix), [](int n) -> DspBlock* { return new Mix(2, 2, n); }, 2, {AUDIO, AUDIO}, RefMix},
+    {"NoiseGen", sizeof(NoiseGen), [](int n) -> DspBlock* { return new NoiseGen(n); }, 1, {UNIT}},
+    {"MusicalTime",
+     sizeof(MusicalTime),
+     [](int n) -> DspBlock* { return new MusicalTime(n); },
+     3,
+     {{60.f, 180.f, false}, {0.25f, 2.f, false}, TRIGGER}},
+    {"StoF", sizeof(StoF), [](int n) -> DspBlock* { return new StoF(n); }, 1, {{1000.f, 96000.f, false}}},
+    {"BPF", sizeof(BPF), [](int n) -> DspBlock* { return new BPF(n); }, 3, {AUDIO, CUTOFF, QUALITY}},
+    {"LPF", sizeof(LPF), [](int n) -> DspBlock* { return new LPF(n); }, 3, {AUDIO, CUTOFF, QUALITY}},
+    {"HPF", sizeof(HPF), [](int n) -> DspBlock* { return new HPF(n); }, 3, {AUDIO, CUTOFF, QUALITY}},
+    {"LPF4", sizeof(LPF), [](int n) -> DspBlock* { return new LPF(4, n); }, 3, {AUDIO, CUTOFF, QUALITY}},
+    {"Compressor",
+     sizeof(dspblock::Compressor),
+     [](int n) -> DspBlock* { return new dspblock::Compressor(n); },
+     5,
+     {AUDIO, {-80.f, 0.f, false}, {1.f, 40.f, false}, {0.001f, 0.1f, false}, {0.01f, 1.f, false}}},
+    {"MBCompressor",
+     sizeof(MBCompressor),
+     [](int n) -> DspBlock* { return new MBCompressor(3, n); },
+     7,
+     {AUDIO,
+      {100.f, 400.f, false},
+      {1000.f, 4000.f, false},
+      {-80.f, 0.f, false},
+      {1.f, 40.f, false},
+      {0.001f, 0.1f, false},
+      {0.01f, 1.f, false}}},
+};
+
+/* Deterministic pseudo random numbers in [0, 1), identical on host and target */
+static uint32_t rng_state = 1;
+static float    PseudoRandom()
+{
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return (rng_state >> 8) * (1.0f / 16777216.0f);
+}
+
+static float RandomValue(const InputRange& port)
+{
+    const float r = PseudoRandom();
+    if(port.discrete)
+    {
+        return r < 0.5f ? port.min : port.max;
+    }
+    return port.min + r * (port.max - port.min);
+}
+
+/* Fills an input signal according to the input kind */
+static void GenerateSignal(float* buf, const InputRange& port, InputKind kind, size_t block_size)
+{
+    const float constant = port.discrete ? port.min : 0.5f * (port.min + port.max);
+    float       value    = constant;
+
+    for(size_t i = 0; i < SIGNAL_LENGTH; i++)
+    {
+        if(kind == INPUT_AUDIO || (kind == INPUT_KNOB && i % block_size == 0))
+        {
+            value = RandomValue(port);
+        }
+        buf[i] = value;
+    }
+}
+
+/* Largest relative difference of one output block to the scalar reference of the case */
+static float ReferenceError(const BenchCase& c, const float* output, size_t pos, size_t block_size)
+{
+    float max_error = 0.f;
+    float in[MAX_INPUTS];
+    for(size_t i = 0; i < block_size; i++)
+    {
+        for(size_t k = 0; k < c.numInputs; k++)
+        {
+            in[k] = signals[k][pos + i];
+        }
+        const float expected = c.reference(in);
+        const float error    = fabsf(output[i] - expected) / fmaxf(1.f, fabsf(expected));
+        max_error            = fmaxf(max_error, error);
+    }
+    return max_error;
+}
+
+/* Ticks of an empty measurement, the least of many, subtracted from every measured handle() call */
+static uint32_t timer_overhead = 0;
+
+static uint32_t TimerOverhead()
+{
+    uint32_t least = UINT32_MAX;
+    for(int i = 0; i < 1000; i++)
+    {
+        ScopedIrqBlocker irq;
+        const uint32_t   t0      = System::GetTick();
+        const uint32_t   elapsed = System::GetTick() - t0;
+        least                    = elapsed < least ? elapsed : least;
+    }
+    return least;
+}
+
+static void RunCase(const BenchCase& c, InputKind kind, size_t block_size)
+{
+    for(size_t k = 0; k < c.numInputs; k++)
+    {
+        GenerateSignal(signals[k], c.ports[k], kind, block_size);
+    }
+
+    DspBlock* block = c.create(block_size);
+    block->initialize(SAMPLE_RATE);
+
+    uint64_t ticks     = 0;
+    uint32_t min_ticks = UINT32_MAX;
+    uint32_t max_ticks = 0;
+    size_t   samples   = 0;
+    float    max_error = 0.f;
+    for(size_t pos = 0; pos + block_size <= SIGNAL_LENGTH; pos += block_size)
+    {
+        for(size_t k = 0; k < c.numInputs; k++)
+        {
+            block->setInputReference(&signals[k][pos], k);
+        }
+
+        /* the first block only warms up caches and state */
+        if(pos == 0)
+        {
+            block->handle();
+            continue;
+        }
+
+        /* disable interrupts for the duration of measurements */
+        ScopedIrqBlocker irq;
+        const uint32_t   t0 = System::GetTick();
+        block->handle();
+        uint32_t elapsed = System::GetTick() - t0;
+        elapsed          = elapsed > timer_overhead ? elapsed - timer_overhead : 0;
+        ticks += elapsed;
+        min_ticks = elapsed < min_ticks ? elapsed : min_ticks;
+        max_ticks = elapsed > max_ticks ? elapsed : max_ticks;
+        samples += block_size;
+
+        if(c.reference != nullptr)
+        {
+            max_error = fmaxf(max_error, ReferenceError(c, block->getOutputChannel(0), pos, block_size));
+        }
+    }
+
+    delete block;
+
+    const float ns_per_sample = 1.0e9f * ticks / ((float)System::GetTickFreq() * samples);
+    const float avg_load      = ns_per_sample * SAMPLE_RATE * 1.0e-9f;
+    /* ticks of one handle() call to the share of its block period */
+    const float ticks_to_load = SAMPLE_RATE / ((float)System::GetTickFreq() * block_size);
+    const uint32_t cpu_freq   = BenchHelper::GetCpuFreq();
+
+    char cycles[16];
+    if(cpu_freq > 0)
+    {
+        snprintf(cycles, sizeof(cycles), "%.1f", ns_per_sample * cpu_freq * 1.0e-9f);
+    }
+    else
+    {
+        snprintf(cycles, sizeof(cycles), "NA");
+    }
+
+    char error[16];
+    if(c.reference != nullptr)
+    {
+        snprintf(error, sizeof(error), "%.2e", max_error);
+    }
+    else
+    {
+        snprintf(error, sizeof(error), "NA");
+    }
+
+    hw.PrintLine("%s\t%s\t%u\t%.3f\t%s\t%.5f\t%.5f\t%.5f\t%.0f\t%s\t%u",
+                 c.name,
+                 c.numInputs > 0 ? InputKindStrings[kind] : "none",
+                 (unsigned)block_size,
+                 ns_per_sample,
+                 cycles,
+                 min_ticks * ticks_to_load,
+                 avg_load,
+                 max_ticks * ticks_to_load,
+                 avg_load > 0.f ? 1.f / avg_load : 0.f,
+                 error,
+                 (unsigned)c.objectBytes);
+}
+
+int main(void)
+{
+    /* Initialize hardware */
+    hw.Prepare();
+    timer_overhead = TimerOverhead();
+
+    /* Print header */
+    hw.PrintLine("# DspBlock benchmark, %.0f Hz", SAMPLE_RATE);
+    hw.PrintLine("block\tinput\tblock_size\tns_per_sample\tcycles_per_sample\tmin_load\tavg_load\tmax_load\tper_callback\tmax_error\tobject_bytes");
+
+    for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        /* blocks without inputs only need one run per block size */
+        const int num_kinds = cases[c].numInputs > 0 ? INPUT_LAST : 1;
+
+        for(int kind = 0; kind < num_kinds; kind++)
+        {
+            for(size_t b = 0; b < sizeof(block_list) / sizeof(block_list[0]); b++)
+            {
+                RunCase(cases[c], (InputKind)kind, block_list[b]);
+            }
+        }
+    }
+
+    hw.Finish();
+    return 0;
+}
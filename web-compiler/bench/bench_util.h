@@ -0,0 +1,81 @@
+#pragma once
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+#include <cstdint>
+#include <cstdio>
+
+#if defined(DAISYDUB_HOST)
+#include "DubbyHost.h"
+#include "sys/system.h"
+
+namespace daisy
+{
+/* Stub for blocking interrupts, nothing to block on the host */
+class ScopedIrqBlocker
+{
+  public:
+    ScopedIrqBlocker() { (void)0; }
+    ~ScopedIrqBlocker() { (void)0; }
+};
+} // namespace daisy
+
+#else   // Daisy target
+#include "daisy_seed.h"
+#include "util/scopedirqblocker.h"
+#endif // DAISYDUB_HOST
+
+/**   @brief Platform wrapper for the DspBlock benchmarks, modelled after DaisySP's DsyTestHelper.
+ *    On the Seed the results are printed over the USB log, on the host to stdout.
+ */
+class BenchHelper
+{
+  public:
+    BenchHelper() {}
+    ~BenchHelper() {}
+
+    void Prepare()
+    {
+#if !defined(DAISYDUB_HOST)
+        hw_.Init(true);
+        hw_.SetLed(true);
+        hw_.StartLog(true);
+#endif
+    }
+
+    void Finish()
+    {
+        PrintLine("# done");
+#if !defined(DAISYDUB_HOST)
+        hw_.SetLed(false);
+#endif
+    }
+
+    template <typename... Args>
+    static void PrintLine(const char* format, Args... args)
+    {
+#if defined(DAISYDUB_HOST)
+        printf(format, args...);
+        printf("\n");
+#else
+        daisy::DaisySeed::PrintLine(format, args...);
+#endif
+    }
+
+    /** Returns the CPU clock in Hz, 0 if it is not known (host) */
+    static uint32_t GetCpuFreq()
+    {
+#if defined(DAISYDUB_HOST)
+        return 0;
+#else
+        return daisy::System::GetSysClkFreq();
+#endif
+    }
+
+  protected:
+#if !defined(DAISYDUB_HOST)
+    daisy::DaisySeed hw_;
+#endif
+};
+
+#endif //__BENCH_UTIL_H__
@@ -0,0 +1,136 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace dspblock
+{
+    /**
+     * Bump allocator over a fixed piece of memory. Allocations are 8 byte aligned and only freed all at once by Reset().
+     * A request that does not fit returns nullptr and marks the arena as overflowed.
+     */
+    class MemoryArena
+    {
+    public:
+        static const size_t ALIGNMENT = 8;
+
+        MemoryArena() {}
+        MemoryArena(void *memory, size_t size) { Init(memory, size); }
+
+        // memory must be aligned to ALIGNMENT
+        void Init(void *memory, size_t size)
+        {
+            this->memory = (uint8_t *)memory;
+            this->size = size;
+            Reset();
+        }
+
+        void *Allocate(size_t bytes)
+        {
+            bytes = Footprint(bytes);
+            if (memory == nullptr || used + bytes > size)
+            {
+                overflowed = true;
+                return nullptr;
+            }
+            void *result = memory + used;
+            used += bytes;
+            return result;
+        }
+
+        void Reset()
+        {
+            used = 0;
+            overflowed = false;
+        }
+
+        bool Contains(const void *pointer) const
+        {
+            return memory != nullptr && (const uint8_t *)pointer >= memory && (const uint8_t *)pointer < memory + size;
+        }
+
+        size_t GetUsed() const { return used; }
+        size_t GetSize() const { return size; }
+        bool HasOverflowed() const { return overflowed; }
+
+        // What an allocation of bytes takes from an arena, sums of these size an arena exactly
+        static constexpr size_t Footprint(size_t bytes)
+        {
+            return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+
+    private:
+        uint8_t *memory = nullptr;
+        size_t size = 0;
+        size_t used = 0;
+        bool overflowed = false;
+    };
+
+    /**
+     * Where DspBlocks take their memory from (output and input channel tables, buffers, delay lines).
+     * Without arenas, e.g. in the playgrounds and benchmarks, everything comes from the heap. The generated firmware sizes
+     * its arenas in the code generator and sets them before constructing the ExecutionPlan, so a patch takes a fixed
+     * amount of memory, laid out in execution order. When an arena runs out, the heap is used instead and the arena
+     * reports HasOverflowed().
+     * Memory from an arena is never freed individually, so blocks must be destroyed before their arenas are changed.
+     */
+    class BlockMemory
+    {
+    public:
+        enum Region
+        {
+            FAST,  // everything read or written in every callback, internal SRAM
+            LARGE, // long buffers only touched at a few positions per sample, e.g. delay lines. SDRAM on the Daisy
+        };
+
+        // large may be nullptr, then LARGE allocations also come from fast
+        static void SetArenas(MemoryArena *fast, MemoryArena *large)
+        {
+            fastArena = fast;
+            largeArena = large;
+        }
+
+        static void *Allocate(size_t bytes, Region region = FAST)
+        {
+            MemoryArena *arena = region == LARGE && largeArena != nullptr ? largeArena : fastArena;
+            void *memory = arena == nullptr ? nullptr : arena->Allocate(bytes);
+            return memory != nullptr ? memory : ::operator new(bytes);
+        }
+
+        template <typename T>
+        static T *Allocate(size_t count, Region region = FAST)
+        {
+            return (T *)Allocate(count * sizeof(T), region);
+        }
+
+        static void Release(void *memory)
+        {
+            if (memory == nullptr || (fastArena != nullptr && fastArena->Contains(memory)) || (largeArena != nullptr && largeArena->Contains(memory)))
+            {
+                return;
+            }
+            ::operator delete(memory);
+        }
+
+        template <typename T, typename... Args>
+        static T *Create(Args &&...args)
+        {
+            return new (Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template <typename T>
+        static void Destroy(T *object)
+        {
+            if (object != nullptr)
+            {
+                object->~T();
+                Release(object);
+            }
+        }
+
+    private:
+        static MemoryArena *fastArena;
+        static MemoryArena *largeArena;
+    };
+}
@@ -2,6 +2,9 @@
 
 using namespace dspblock;
 
+MemoryArena *BlockMemory::fastArena = nullptr;
+MemoryArena *BlockMemory::largeArena = nullptr;
+
 void Clock::initialize(float samplerate)
 {
         this->samplerate = samplerate;
@@ -17,17 +20,18 @@ void Clock::handle()
         }
         // Note: In case of decimal periods, this will always round down
         int periodSamples = (1 / freqHz) * samplerate;
+        float *__restrict output = out->getChannel(0);
 
         for (int i = 0; i < bufferLength; i++)
         {
                 if (samplesSinceTick == periodSamples - 1)
                 {
-                        out->writeSample(1.f, i, 0);
+                        output[i] = 1.f;
                         samplesSinceTick = 0;
                 }
                 else
                 {
-                        out->writeSample(0, i, 0);
+                        output[i] = 0;
                         samplesSinceTick++;
                 }
         }
@@ -54,12 +58,10 @@ void Osc::handle()
         // Important note: Here we assume, that the value of freqIn[0] is provided in Hz. But that will not work generically. For example imagine we pluck the output of an osc into the freq input of this osc
         // in that case freqIn[0] would be some value between -1 and 1, which does not make sense in terms of Hz. We need to figure out how to make this better.
         osc.SetFreq(freqIn[0]);
+        float *__restrict output = out->getChannel(0);
         for (auto i = 0; i < bufferLength; i++)
         {
-                float osc_out = osc.Process();
-                // Apply the amp input
-                // Set the left and right outputs
-                out->writeSample(osc_out, i, 0);
+                output[i] = osc.Process();
         }
 }
 
@@ -70,7 +72,8 @@ void ADSREnv::initialize(float samplerate)
 
 void ADSREnv::handle()
 {
-        float *trigger = getInputReference(0);
+        const float *__restrict trigger = getInputReference(0);
+        float *__restrict output = out->getChannel(0);
         float attack = abs(getInputReference(1)[0]);
         float decay = abs(getInputReference(2)[0]);
         float sustain = abs(getInputReference(3)[0]);
@@ -87,7 +90,7 @@ void ADSREnv::handle()
                 {
                         env.Retrigger(false);
                 }
-                out->writeSample(env.Process(false), i, 0);
+                output[i] = env.Process(false);
         }
 }
 
@@ -101,36 +104,73 @@ void FeedbackDelay::initialize(float samplerate)
 
 void FeedbackDelay::handle()
 {
-        float *audioIn = getInputReference(0);
-        float *ampDelay = getInputReference(1);
+        const float *__restrict audioIn = getInputReference(0);
+        const float *__restrict ampDelay = getInputReference(1);
+        float *__restrict output = out->getChannel(0);
 
         for (int i = 0; i < bufferLength; i++)
         {
                 int readFrom = (circBufPos + i) % delayLengthSamples;
-                float output = (1 - ampDelay[i]) * audioIn[i] + ampDelay[i] * circBuf[readFrom];
-                out->writeSample(output, i, 0);
-                circBuf[readFrom] = output;
+                float sample = (1 - ampDelay[i]) * audioIn[i] + ampDelay[i] * circBuf[readFrom];
+                output[i] = sample;
+                circBuf[readFrom] = sample;
         }
         circBufPos = (circBufPos + bufferLength) % delayLengthSamples;
 }
 
+void BlockDelay::initialize(float samplerate)
+{
+        memset(state, 0, bufferLength * sizeof(float));
+}
+
+void DspBlock::bypass()
+{
+        const int bypassInput = getBypassInput();
+        float *input = bypassInput >= 0 && bypassInput < numInputs ? inputChannels[bypassInput] : nullptr;
+        for (int ch = 0; ch < getNumOutputs(); ch++)
+        {
+                if (ch == 0 && input != nullptr)
+                {
+                        kernels::copy(input, out->getChannel(ch), bufferLength);
+                }
+                else
+                {
+                        kernels::fill(0.f, out->getChannel(ch), bufferLength);
+                }
+        }
+}
+
+void BlockDelay::handle()
+{
+        memcpy(out->getChannel(0), state, bufferLength * sizeof(float));
+}
+
+void BlockDelay::latch()
+{
+        memcpy(state, getInputReference(0), bufferLength * sizeof(float));
+}
+
 void KnobMap::handle()
 {
-        float val = dubby.GetKnobValue(knob);
-        for (int i = 0; i < bufferLength; i++)
+        const int length = samplesToProcess();
+        float val = value;
+        float *__restrict output = out->getChannel(0);
+        for (int i = 0; i < length; i++)
         {
-                out->writeSample(val, i, 0);
+                output[i] = val;
         }
 }
 
 void DubbyKnobs::handle()
 {
+        const int length = samplesToProcess();
         for (int k = 0; k < 4; k++)
         {
-                float val = dubby.GetKnobValue(knobs[k]);
-                for (int i = 0; i < bufferLength; i++)
+                float val = values[k];
+                float *__restrict output = out->getChannel(k);
+                for (int i = 0; i < length; i++)
                 {
-                        out->writeSample(val, i, k);
+                        output[i] = val;
                 }
         }
 }
@@ -160,20 +200,32 @@ void ConstValue::initialize(float samplerate)
         }
 }
 
+void ConstValue::setParameter(int param, float value)
+{
+        if (param == 0)
+        {
+                val = value;
+                kernels::fill(val, out->getChannel(0), bufferLength);
+        }
+}
+
 // -----------------------------MATH OPERATIORS ------------------------------------//
 
 //----Multiplier----//
 // Multiplies n diferent channel input values and outputs the result
 void NMultiplier::handle()
 {
-        for (int i = 0; i < bufferLength; i++)
+        const int length = samplesToProcess();
+        float *output = out->getChannel(0);
+        if (numInputs == 0)
         {
-                float mul = 1;
-                for (int k = 0; k < numInputs; k++)
-                {
-                        mul *= getInputReference(k)[i];
-                }
-                out->writeSample(mul, i, 0);
+                kernels::fill(1.f, output, length);
+                return;
+        }
+        kernels::copy(inputChannels[0], output, length);
+        for (int k = 1; k < numInputs; k++)
+        {
+                kernels::multiply(output, inputChannels[k], output, length);
         }
 }
 
@@ -181,109 +233,107 @@ void NMultiplier::handle()
 // Add n diferent channel input values and outputs the result
 void Sum::handle()
 {
-        for (int i = 0; i < bufferLength; i++)
+        const int length = samplesToProcess();
+        float *output = out->getChannel(0);
+        if (numInputs == 0)
         {
-                float sum = 0;
-                for (int k = 0; k < numInputs; k++)
-                {
-                        sum += getInputReference(k)[i];
-                }
-                out->writeSample(sum, i, 0);
+                kernels::fill(0.f, output, length);
+                return;
+        }
+        kernels::copy(inputChannels[0], output, length);
+        for (int k = 1; k < numInputs; k++)
+        {
+                kernels::add(output, inputChannels[k], output, length);
         }
 }
 //---Subtraction----/
-// Subtract n diferent channel input values and outputs the result
+// Subtracts the channels 1..n-1 from channel 0 and outputs the result
 void Sub::handle()
 {
-        for (int i = 0; i < bufferLength; i++)
+        const int length = samplesToProcess();
+        float *output = out->getChannel(0);
+        if (numInputs == 0)
         {
-                float sub = 0;
-                for (int k = 0; k < numInputs; k++)
-                {
-                        sub -= getInputReference(k)[i];
-                }
-                out->writeSample(sub, i, 0);
+                kernels::fill(0.f, output, length);
+                return;
+        }
+        kernels::copy(inputChannels[0], output, length);
+        for (int k = 1; k < numInputs; k++)
+        {
+                kernels::subtract(output, inputChannels[k], output, length);
         }
 }
 
 //---Division----//
-// Divides n diferent channel input values and outputs the result
+// Divides channel 0 by the channels 1..n-1 and outputs the result
 
 void Div::handle()
 {
-        for (int i = 0; i < bufferLength; i++)
+        const int length = samplesToProcess();
+        float *output = out->getChannel(0);
+        if (numInputs == 0)
         {
-                float div = 0;
-                for (int k = 0; k < numInputs; k++)
-                {
-                        div /= getInputReference(k)[i];
-                }
-                out->writeSample(div, i, 0);
+                kernels::fill(0.f, output, length);
+                return;
+        }
+        kernels::copy(inputChannels[0], output, length);
+        for (int k = 1; k < numInputs; k++)
+        {
+                kernels::divide(output, inputChannels[k], output, length);
         }
 }
 
 void Scaler::handle()
 {
-        float oldRange = inMax - inMin;
-        float newRange = outMax - outMin;
-        float newValue;
+        const int length = samplesToProcess();
+        // (in - inMin) * newRange / oldRange + outMin, as one multiplication and one addition
+        float gain = (outMax - outMin) / (inMax - inMin);
+        float *output = out->getChannel(0);
 
-        for (int sample = 0; sample < bufferLength; sample++)
-        {
-
-                newValue = (((getInputReference(0)[sample] - inMin) * newRange) / oldRange) + outMin;
-
-                out->writeSample(newValue, sample, 0);
-        }
+        kernels::scale(getInputReference(0), gain, output, length);
+        kernels::offset(output, outMin - inMin * gain, output, length);
 }
 
 //---------------------------- END OF MATH OPERATORS --------------------------//
 
 void Unipolariser::handle()
 {
-        float *in = getInputReference(0);
-
-        for (int i = 0; i < bufferLength; i++)
-        {
-                out->writeSample(abs(in[i]), i, 0);
-        }
+        const int length = samplesToProcess();
+        kernels::absolute(getInputReference(0), out->getChannel(0), length);
 }
 
 //--------Volume Controller----------//
 
 void VolumeControl::handle()
 {
-        float *amp = getInputReference(0);
-        float in = 0;
-
-        for (int sample = 0; sample < bufferLength; sample++)
-        {
-                in = getInputReference(1)[sample];
-                in *= amp[sample];
-
-                out->writeSample(in, sample, 0);
-        }
+        const int length = samplesToProcess();
+        // input 0 is the amplitude, input 1 the signal
+        kernels::multiply(getInputReference(1), getInputReference(0), out->getChannel(0), length);
 }
 
 //--------Mixer----------//
 
 void Mix::handle()
 {
-        float in = 0;
-        for (int sample = 0; sample < bufferLength; sample++)
+        // Average of all inputs, written to every output
+        float *first = out->getChannel(0);
+        if (numInputs == 0)
         {
-
-                for (int chIn = 0; chIn < numInputs; chIn++)
+                kernels::fill(0.f, first, bufferLength);
+        }
+        else
+        {
+                kernels::copy(inputChannels[0], first, bufferLength);
+                for (int chIn = 1; chIn < numInputs; chIn++)
                 {
-                        in += getInputReference(chIn)[sample];
+                        kernels::add(first, inputChannels[chIn], first, bufferLength);
                 }
+                kernels::scale(first, 1.f / numInputs, first, bufferLength);
+        }
 
-                in /= numInputs;
-
-                for (int ch = 0; ch < numOutputs; ch++)
-                {
-                        out->writeSample(in, sample, ch);
-                }
+        for (int ch = 1; ch < numOutputs; ch++)
+        {
+                kernels::copy(first, out->getChannel(ch), bufferLength);
         }
 }
 
@@ -294,45 +344,48 @@ void Mix::handle()
 // Dotted Off = 0; Dotted On = 1;
 #include <cmath>
 
-void MusicalTime::handle()
+void MusicalTime::initialize(float samplerate)
 {
+        this->samplerate = samplerate;
+}
 
-        int fs = 48000;
-        float *bpm = getInputReference(0);
-        float *notevalue = getInputReference(1);
-        float *dotted = getInputReference(2);
-        float delayInsamples;
-        for (int sample = 0; sample < bufferLength; sample++)
+void MusicalTime::handle()
+{
+        const int length = samplesToProcess();
+
+        const float fs = samplerate;
+        const float *__restrict bpm = getInputReference(0);
+        const float *__restrict notevalue = getInputReference(1);
+        const float *__restrict dotted = getInputReference(2);
+        float *__restrict output = out->getChannel(0);
+        for (int sample = 0; sample < length; sample++)
         {
-                
-                if (dotted[sample] == 1)
-                {
-                        dotted[sample] = 0.5 * notevalue[sample];
-                }
-                else if (dotted[sample] == 0)
-                       { dotted[sample] = 0; }
-
-                if (bpm[sample] > 0)
+                // Dotted adds half of the note value. Kept local, the input buffer belongs to the upstream block
+                float dot = dotted[sample];
+                if (dot == 1)
                 {
-                        bpm[sample] = bpm[sample];
+                        dot = 0.5 * notevalue[sample];
                 }
 
-                delayInsamples = round((60 / bpm[sample]) * fs * (notevalue[sample] + dotted[sample]));
-
-                out->writeSample(delayInsamples, sample, 0);
+                output[sample] = round((60 / bpm[sample]) * fs * (notevalue[sample] + dot));
         }
 }
 
+void StoF::initialize(float samplerate)
+{
+        this->samplerate = samplerate;
+}
+
 void StoF::handle()
 {
-        float *tsamples = getInputReference(0); // Time in samples (input)
-        float tHz;                              // time in HZ (output)
-        int fs = 48000;
+        const int length = samplesToProcess();
+        const float *__restrict tsamples = getInputReference(0); // Time in samples (input)
+        float *__restrict tHz = out->getChannel(0);              // time in HZ (output)
+        const float fs = samplerate;
 
-        for (int sample = 0; sample < bufferLength; sample++)
+        for (int sample = 0; sample < length; sample++)
         { 
-                tHz = (fs / tsamples[sample]) / 2 ;
-                out->writeSample(tHz, sample, 0);
+                tHz[sample] = (fs / tsamples[sample]) / 2 ;
         }
 }
 
@@ -347,17 +400,14 @@ NoiseGen::NoiseGen(int bufferLenth) : NoiseGen::DspBlock(1, 1, bufferLenth){};
 void NoiseGen::handle()
 {
 
-        float *amp = getInputReference(0);
-        float noiseOut = 0;
+        const float *__restrict amp = getInputReference(0);
+        float *__restrict output = out->getChannel(0);
 
         for (auto sample = 0; sample < bufferLength; sample++)
         {
                 float r = (static_cast<float>(std::rand() / static_cast<float>(RAND_MAX / 2))) - 1;
 
-                noiseOut = r;
-                noiseOut *= amp[sample];
-
-                out->writeSample(noiseOut, sample, 0);
+                output[sample] = r * amp[sample];
         }
     
 }
@@ -391,185 +441,289 @@ void dspblock::Compressor::handle() {
 
 /* --------MultiBand Compressor---------------*/
 
+// Butterworth quality, two of those sections make a Linkwitz-Riley crossover
+static const float LINKWITZ_RILEY_Q = 0.70710678f;
+
+MBCompressor::MBCompressor(int numBands, int bufferLength) : DspBlock(numBands + 4, 1, bufferLength)
+{
+        if (numBands < 2) numBands = 2;
+        else if (numBands > MAX_BANDS) numBands = MAX_BANDS;
+        this->numBands = numBands;
+        bandBuffers = BlockMemory::Allocate<float>(numBands * bufferLength);
+}
+
+void MBCompressor::initialize(float samplerate)
+{
+        for (int x = 0; x < numBands - 1; x++)
+        {
+                crossovers[x] = -1;
+                lowPass[x].init(BiquadCascade::LOW_PASS, 2, samplerate);
+                highPass[x].init(BiquadCascade::HIGH_PASS, 2, samplerate);
+                for (int band = 0; band < numBands; band++)
+                {
+                        // the sum of a Linkwitz-Riley low and high pass is a 2nd order allpass
+                        allPass[band][x].init(BiquadCascade::ALL_PASS, 1, samplerate);
+                }
+        }
+        for (int band = 0; band < numBands; band++)
+        {
+                compressors[band].Init(samplerate);
+        }
+        thr = ratio = attack = release = -1;
+}
+
+void MBCompressor::handle()
+{
+        // Crossovers, each at least at the previous one
+        float lowest = 20.f;
+        for (int x = 0; x < numBands - 1; x++)
+        {
+                float fc = getInputReference(1 + x)[0];
+                if (fc < lowest) fc = lowest;
+                else if (fc > 20000) fc = 20000;
+                lowest = fc;
+                if (fc != crossovers[x])
+                {
+                        crossovers[x] = fc;
+                        lowPass[x].setParameters(fc, LINKWITZ_RILEY_Q);
+                        highPass[x].setParameters(fc, LINKWITZ_RILEY_Q);
+                        for (int band = 0; band < x; band++)
+                        {
+                                allPass[band][x].setParameters(fc, LINKWITZ_RILEY_Q);
+                        }
+                }
+        }
+
+        // Compressor settings, the setters recompute exponentials so they only run on changes
+        float newThr = getInputReference(numBands)[0];
+        float newRatio = getInputReference(numBands + 1)[0];
+        float newAttack = getInputReference(numBands + 2)[0];
+        float newRelease = getInputReference(numBands + 3)[0];
+
+        if (newThr > 0.f) newThr = 0.f; else if (newThr < -80.f) newThr = -80.f;
+        if (newRatio > 40.f) newRatio = 40.f; else if (newRatio < 1.f) newRatio = 1.f;
+        if (newAttack > 10.f) newAttack = 10.f; else if (newAttack < 0.001f) newAttack = 0.001f;
+        if (newRelease > 10.f) newRelease = 10.f; else if (newRelease < 0.001f) newRelease = 0.001f;
+
+        for (int band = 0; band < numBands; band++)
+        {
+                if (newThr != thr) compressors[band].SetThreshold(newThr);
+                if (newRatio != ratio) compressors[band].SetRatio(newRatio);
+                if (newAttack != attack) compressors[band].SetAttack(newAttack);
+                if (newRelease != release) compressors[band].SetRelease(newRelease);
+        }
+        thr = newThr;
+        ratio = newRatio;
+        attack = newAttack;
+        release = newRelease;
+
+        // Split: band x is the low pass of the rest at crossover x, the high pass is the rest for the next crossover
+        float *rest = getInputReference(0);
+        for (int x = 0; x < numBands - 1; x++)
+        {
+                float *low = &bandBuffers[x * bufferLength];
+                float *high = &bandBuffers[(x + 1) * bufferLength];
+                highPass[x].process(rest, high, bufferLength);
+                lowPass[x].process(rest, low, bufferLength);
+                rest = high;
+        }
+
+        // Phase align the lower bands with the crossovers they did not pass
+        for (int band = 0; band < numBands - 2; band++)
+        {
+                float *buf = &bandBuffers[band * bufferLength];
+                for (int x = band + 1; x < numBands - 1; x++)
+                {
+                        allPass[band][x].process(buf, buf, bufferLength);
+                }
+        }
+
+        float *output = out->getChannel(0);
+        for (int band = 0; band < numBands; band++)
+        {
+                float *buf = &bandBuffers[band * bufferLength];
+                compressors[band].ProcessBlock(buf, buf, bufferLength);
+                if (band == 0)
+                {
+                        kernels::copy(buf, output, bufferLength);
+                }
+                else
+                {
+                        kernels::add(output, buf, output, bufferLength);
+                }
+        }
+}
+
 
 //----fliter----
 
-// Band Pass Filter
-
-void BPF::handle()
-{       
-        float * in = getInputReference(0);
-        float * fc = getInputReference(1);
-        float * q = getInputReference(2); 
-        
-        
-        float w0=0, cosw = 0, sinw = 0, alpha = 0;
-        
-        float b_0, b_1, b_2, a_0, a_1, a_2, B0 , B1, B2, A1, A2;
-        float fltOut=0;
-
-        for (int sample = 0; sample < bufferLength; sample++)
-        {       
-                float Q = q[sample];
-                if (Q > 10) Q = 10;
-                else if (Q < 0.7) Q = 0.7;
-
-                float Fc = fc[sample];
-                if (Fc < 20) Fc = 20;
-                else if (Fc > 20000) Fc = 20000;
-                
-                cirBuffin[sample%4] = in[sample];
-                
-
-                w0 = (2 * M_PI * Fc) / 48000;
-                cosw = cos(w0);
-                sinw = sin(w0);
-                alpha = sinw / (2 * Q);
-                
-                b_0 = alpha;
-                b_1 = 0;
-                b_2 = -alpha;
-                
-                a_0 = 1 + alpha;
-                a_1 = -2 * cosw;
-                a_2 = 1 - alpha;
-
-                B0 = b_0/a_0;
-                B1 = b_1/a_0;
-                B2 = b_2/a_0;
-                A1 = a_1/a_0;
-                A2 = a_2/a_0;
-                
-                float n_1 = cirBuffin[(4+sample-1)%4];
-                float n_2 = cirBuffin[(4+sample-2)%4];
-                float yn_1 = cirBuffout[(4 + sample - 1) % 4];
-                float yn_2 = cirBuffout[(4 + sample - 2) % 4];
-
-                fltOut = in[sample] * B0 + n_1 * B1 + n_2 * B2  -  yn_1 * A1 - yn_2 * A2;
-
-                cirBuffout[sample%4] = fltOut;
-
-                out->writeSample(fltOut, sample , 0);
-
-        }
-}
-
-
-//-----LPF----
-
-void LPF::handle()
-{       
-        float * in = getInputReference(0);
-        float * fc = getInputReference(1);
-        float * q = getInputReference(2); 
-              
-        float w0=0, cosw = 0, sinw = 0, alpha = 0;
-        
-        float b_0, b_1, b_2, a_0, a_1, a_2, B0 , B1, B2, A1, A2;
-        float fltOut=0;
-
-        for (int sample = 0; sample < bufferLength; sample++)
-        {       
-                float Q = q[sample];
-                if (Q > 10) Q = 10;
-                else if (Q < 0.7) Q = 0.7;
-
-                float Fc = fc[sample];
-                if (Fc < 20) Fc = 20;
-                else if (Fc > 20000) Fc = 20000;
-
-                cirBuffin[sample%4] = in[sample];
-                
-
-                w0 = (2 * M_PI * Fc) / 48000;
-                cosw = cos(w0);
-                sinw = sin(w0);
-                alpha = sinw / (2 * Q);
-                
-                b_0 = 1 * ((1 - cosw) / 2);
-                b_1 = 1 * (1 - cosw);
-                b_2 = 1 * ((1 - cosw)/ 2);
-                
-                a_0 = 1 + alpha;
-                a_1 = -2 * cosw;
-                a_2 = 1 - alpha;
-
-                B0 = b_0/a_0;
-                B1 = b_1/a_0;
-                B2 = b_2/a_0;
-                A1 = a_1/a_0;
-                A2 = a_2/a_0;
-                
-                float n_1 = cirBuffin[(4+sample-1)%4];
-                float n_2 = cirBuffin[(4+sample-2)%4];
-                float yn_1 = cirBuffout[(4 + sample - 1) % 4];
-                float yn_2 = cirBuffout[(4 + sample - 2) % 4];
-
-                fltOut = in[sample] * B0 + n_1 * B1 + n_2 * B2  -  yn_1 * A1 - yn_2 * A2;
-
-                cirBuffout[sample%4] = fltOut;
-
-                out->writeSample(fltOut, sample , 0);
-
-        }
-}
-
-//----High Pass Filter HPF-----
-
-void HPF::handle()
-{       
-        float * in = getInputReference(0);
-        float * fc = getInputReference(1);
-        float * q = getInputReference(2); 
-        
-       float w0=0, cosw = 0, sinw = 0, alpha = 0;
-        
-        float b_0, b_1, b_2, a_0, a_1, a_2, B0 , B1, B2, A1, A2;
-        float fltOut=0;
-
-        for (int sample = 0; sample < bufferLength; sample++)
-        {       
-                float Q = q[sample];
-                if (Q > 10) Q = 10;
-                else if (Q < 0.7) Q = 0.7;
-
-                float Fc = fc[sample];
-                if (Fc < 20) Fc = 20;
-                else if (Fc > 20000) Fc = 20000;
-
+// Runs one transposed direct form II stage. If step is given, c is moved by step every sample
+static inline void processBiquadStage(const float *src, float *dst, int length, float *c, const float *step, float *state)
+{
+        float d1 = state[0];
+        float d2 = state[1];
+        if (step == nullptr)
+        {
+                for (int i = 0; i < length; i++)
+                {
+                        float x = src[i];
+                        float y = c[0] * x + d1;
+                        d1 = c[1] * x + c[3] * y + d2;
+                        d2 = c[2] * x + c[4] * y;
+                        dst[i] = y;
+                }
+        }
+        else
+        {
+                for (int i = 0; i < length; i++)
+                {
+                        for (int j = 0; j < 5; j++)
+                        {
+                                c[j] += step[j];
+                        }
+                        float x = src[i];
+                        float y = c[0] * x + d1;
+                        d1 = c[1] * x + c[3] * y + d2;
+                        d2 = c[2] * x + c[4] * y;
+                        dst[i] = y;
+                }
+        }
+        state[0] = d1;
+        state[1] = d2;
+}
+
+BiquadCascade::BiquadCascade()
+{
+        init(LOW_PASS, 1);
+}
 
-                cirBuffin[sample%4] = in[sample];
-                
+void BiquadCascade::init(Type type, int stages, float samplerate)
+{
+        this->type = type;
+        this->samplerate = samplerate;
+        if (stages < 1) stages = 1;
+        else if (stages > MAX_STAGES) stages = MAX_STAGES;
+        this->stages = stages;
+
+        kernels::fill(0.f, coeffs, 5 * MAX_STAGES);
+        kernels::fill(0.f, target, 5);
+        kernels::fill(0.f, state, 2 * MAX_STAGES);
+        cachedFc = -1;
+        cachedQ = -1;
+        interpolate = false;
+#ifndef DAISYDUB_HOST
+        arm_biquad_cascade_df2T_init_f32(&cascade, stages, coeffs, state);
+#endif
+}
 
-                w0 = (2 * M_PI * Fc) / 48000;
-                cosw = cos(w0);
-                sinw = sin(w0);
-                alpha = sinw / (2 * Q);
-                
-                b_0 = 1 * ((1 + cosw) / 2);
-                b_1 = 1 * (-(1 + cosw));
-                b_2 = 1 * ((1 + cosw)/ 2);
-                
-                a_0 = 1 + alpha;
-                a_1 = -2 * cosw;
-                a_2 = 1 - alpha;
-
-                B0 = b_0/a_0;
-                B1 = b_1/a_0;
-                B2 = b_2/a_0;
-                A1 = a_1/a_0;
-                A2 = a_2/a_0;
-                
-                float n_1 = cirBuffin[(4+sample-1)%4];
-                float n_2 = cirBuffin[(4+sample-2)%4];
-                float yn_1 = cirBuffout[(4 + sample - 1) % 4];
-                float yn_2 = cirBuffout[(4 + sample - 2) % 4];
-
-                fltOut = in[sample] * B0 + n_1 * B1 + n_2 * B2  -  yn_1 * A1 - yn_2 * A2;
-
-                cirBuffout[sample%4] = fltOut;
-
-                out->writeSample(fltOut, sample , 0);
+void BiquadCascade::computeCoefficients(float fc, float q, float *c)
+{
+        // Below Nyquist, at 32 kHz the 20 kHz the blocks allow would be above it
+        if (fc > 0.45f * samplerate) fc = 0.45f * samplerate;
+        float w0 = (2 * M_PI * fc) / samplerate;
+        float cosw = cosf(w0);
+        float alpha = sinf(w0) / (2 * q);
+        float a0 = 1 + alpha;
+
+        switch (type)
+        {
+        case LOW_PASS:
+                c[0] = ((1 - cosw) / 2) / a0;
+                c[1] = (1 - cosw) / a0;
+                c[2] = c[0];
+                break;
+        case HIGH_PASS:
+                c[0] = ((1 + cosw) / 2) / a0;
+                c[1] = -(1 + cosw) / a0;
+                c[2] = c[0];
+                break;
+        case BAND_PASS:
+                c[0] = alpha / a0;
+                c[1] = 0;
+                c[2] = -alpha / a0;
+                break;
+        case ALL_PASS:
+                c[0] = (1 - alpha) / a0;
+                c[1] = (-2 * cosw) / a0;
+                c[2] = 1;
+                break;
+        }
+        // CMSIS-DSP adds the feedback terms, so a1 and a2 are negated
+        c[3] = (2 * cosw) / a0;
+        c[4] = -(1 - alpha) / a0;
+}
 
+void BiquadCascade::setParameters(float fc, float q)
+{
+        if (fc == cachedFc && q == cachedQ)
+        {
+                return;
         }
+        computeCoefficients(fc, q, target);
+        if (cachedFc < 0)
+        {
+                // first parameters, nothing to interpolate from
+                for (int s = 0; s < stages; s++)
+                {
+                        kernels::copy(target, &coeffs[5 * s], 5);
+                }
+        }
+        else
+        {
+                interpolate = true;
+        }
+        cachedFc = fc;
+        cachedQ = q;
+}
+
+void BiquadCascade::process(float *in, float *out, int length)
+{
+        if (!interpolate)
+        {
+#ifdef DAISYDUB_HOST
+                for (int s = 0; s < stages; s++)
+                {
+                        processBiquadStage(s == 0 ? in : out, out, length, &coeffs[5 * s], nullptr, &state[2 * s]);
+                }
+#else
+                arm_biquad_cascade_df2T_f32(&cascade, in, out, length);
+#endif
+                return;
+        }
+
+        // Interpolate from the current to the target coefficients over this block
+        float step[5];
+        for (int j = 0; j < 5; j++)
+        {
+                step[j] = (target[j] - coeffs[j]) / length;
+        }
+        for (int s = 0; s < stages; s++)
+        {
+                float c[5] = {coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]};
+                processBiquadStage(s == 0 ? in : out, out, length, c, step, &state[2 * s]);
+        }
+        for (int s = 0; s < stages; s++)
+        {
+                kernels::copy(target, &coeffs[5 * s], 5);
+        }
+        interpolate = false;
+}
+
+void BiquadFilter::initialize(float samplerate)
+{
+        filter.init(type, stages, samplerate);
+}
+
+void BiquadFilter::handle()
+{
+        float Q = getInputReference(2)[0];
+        if (Q > 10) Q = 10;
+        else if (Q < 0.7) Q = 0.7;
+
+        float Fc = getInputReference(1)[0];
+        if (Fc < 20) Fc = 20;
+        else if (Fc > 20000) Fc = 20000;
+
+        filter.setParameters(Fc, Q);
+        filter.process(getInputReference(0), out->getChannel(0), bufferLength);
 }
@@ -1,7 +1,17 @@
+#pragma once
 #include <string>
+#include <cstring>
+#ifdef DAISYDUB_HOST
+// Host (PC) build, see web-compiler/host
+#include "daisysp.h"
+#include "DubbyHost.h"
+#else
 #include "daisy_seed.h"
 #include "daisysp.h"
 #include "Dubby.h"
+#endif
+#include "DspKernels.h"
+#include "BlockMemory.h"
 
 /*_________________________________*/
 
@@ -13,6 +23,9 @@ namespace dspblock
     /**
      * Stores a variable amount of channels sequentially in a single buffer in the format of
      * { A_1, A_2, B_1, B_2, ..., N_1, N_2} and provides access to individual channels.
+     * Channels can also be pointed to memory owned by someone else, e.g. the shared buffer pool of a patch.
+     * The own buffer is only allocated (from BlockMemory) once a channel that was not pointed elsewhere is used,
+     * so a block whose outputs all live in the buffer pool never takes memory for it.
      */
     class MultiChannelBuffer
     {
@@ -21,13 +34,24 @@ namespace dspblock
         {
             this->numChannels = numChannels;
             this->samplesPerChannel = bufferSizePerChannel;
-            // Initialize the buffer with appropriate size: channels * samplesPerChannel
-            buffer = new float[numChannels * bufferSizePerChannel];
-            for (int i = 0; i < numChannels * bufferSizePerChannel; i++)
+            this->buffer = nullptr;
+            // nullptr until the channel is assigned or the own buffer is allocated
+            channels = BlockMemory::Allocate<float *>(numChannels);
+            for (int ch = 0; ch < numChannels; ch++)
             {
-                buffer[i] = 0;
+                channels[ch] = nullptr;
             }
         };
+        ~MultiChannelBuffer()
+        {
+            BlockMemory::Release(buffer);
+            BlockMemory::Release(channels);
+        };
+
+        int getNumChannels()
+        {
+            return numChannels;
+        };
 
         // Function to get a pointer to the first sample of a specified channel
         float *getChannel(int channelNumber)
@@ -37,11 +61,36 @@ namespace dspblock
             {
                 return nullptr;
             }
-            // Calculate the starting index of the specified channel
-            int startIndex = channelNumber * samplesPerChannel;
             // Return the pointer to the first sample of the specified channel
             //  Note: For this to work, it is assumed that the consumer of this buffer knows how many samples are in a single channel buffer. Otherwise weird stuff could happen
-            return &buffer[startIndex];
+            return channels[channelNumber] != nullptr ? channels[channelNumber] : allocateBuffer(channelNumber);
+        };
+
+        // Point a channel to external memory of samplesPerChannel samples, which must outlive this buffer
+        void assignChannel(float *data, int channelNumber)
+        {
+            if (channelNumber < 0 || channelNumber >= numChannels || data == nullptr)
+            {
+                return;
+            }
+            channels[channelNumber] = data;
+        };
+
+        // Point every channel that does not use external memory yet to data, the own buffer is then never allocated
+        //  Note: All channels may end up on the same memory, so only use it for channels nobody reads
+        void assignRemainingChannels(float *data)
+        {
+            if (buffer != nullptr || data == nullptr)
+            {
+                return;
+            }
+            for (int ch = 0; ch < numChannels; ch++)
+            {
+                if (channels[ch] == nullptr)
+                {
+                    channels[ch] = data;
+                }
+            }
         };
 
         // Write data to a channel by just specifying its channel number
@@ -53,13 +102,12 @@ namespace dspblock
                 return;
             }
 
-            // Calculate starting position for writing
-            int startIndex = channelNumber * samplesPerChannel;
             // Copy the provided buffer into the multichannel buffer
-            std::memcpy(&buffer[startIndex], data, samplesPerChannel * sizeof(float));
+            std::memcpy(getChannel(channelNumber), data, samplesPerChannel * sizeof(float));
         };
 
         // Write a single sample to a specified channel at a specified index
+        //  Note: Bounds checked on every call, so better not use it in handle(). Write through getChannel() there instead
         void writeSample(float sample, int index, int channelNumber)
         {
             // Check if the provided channelNumber is with in the range of existing channels
@@ -72,13 +120,30 @@ namespace dspblock
             {
                 return;
             }
-            // Get the correct write position
-            int writePos = channelNumber * samplesPerChannel + index;
-            buffer[writePos] = sample;
+            getChannel(channelNumber)[index] = sample;
         }
 
     private:
+        // Allocates the own buffer, zeroed, for every channel that is not assigned yet and returns channelNumber's start
+        float *allocateBuffer(int channelNumber)
+        {
+            buffer = BlockMemory::Allocate<float>(numChannels * samplesPerChannel);
+            for (int i = 0; i < numChannels * samplesPerChannel; i++)
+            {
+                buffer[i] = 0;
+            }
+            for (int ch = 0; ch < numChannels; ch++)
+            {
+                if (channels[ch] == nullptr)
+                {
+                    channels[ch] = &buffer[ch * samplesPerChannel];
+                }
+            }
+            return channels[channelNumber];
+        }
+
         float *buffer;
+        float **channels;      // Start of every channel, in buffer or external memory
         int numChannels;       // Number of channels
         int samplesPerChannel; // Number of samples per channel
     };
@@ -91,19 +156,53 @@ namespace dspblock
         DspBlock(int numberIns, int numberOuts, int bufferLength)
         {
             this->bufferLength = bufferLength;
+            this->numInputs = numberIns;
             // Initialize the output Multichannel buffer
             //  Note: How many DspBlocks will there be that have more than one output? Probably not many and the ones that are, we can probably neglect
-            out = new MultiChannelBuffer(numberOuts, bufferLength);
-            this->inputChannels = new float *[numberIns];
+            out = BlockMemory::Create<MultiChannelBuffer>(numberOuts, bufferLength);
+            this->inputChannels = BlockMemory::Allocate<float *>(numberIns);
+            for (int ch = 0; ch < numberIns; ch++)
+            {
+                this->inputChannels[ch] = nullptr;
+            }
         };
-        ~DspBlock() = default;
+        virtual ~DspBlock()
+        {
+            BlockMemory::Destroy(out);
+            BlockMemory::Release(inputChannels);
+        };
+        // Memory a block with these channels takes from BlockMemory in its constructor, without the own output buffer
+        // and without what the subclass allocates. Used by the code generator to size the arenas
+        static constexpr size_t memoryFootprint(int numberIns, int numberOuts)
+        {
+            return MemoryArena::Footprint(sizeof(MultiChannelBuffer)) + MemoryArena::Footprint(numberOuts * sizeof(float *)) + MemoryArena::Footprint(numberIns * sizeof(float *));
+        }
         // Override this function, to handle everything that needs to be only handled once at the beginning
         virtual void initialize(float samplerate) = 0;
         virtual void handle() = 0;
+        // Runs instead of handle() while the patch is degraded (see OverrunMonitor), for blocks marked non-essential:
+        // output 0 is a copy of the input getBypassInput(), the other outputs are silent
+        void bypass();
+        // Override this function, if the block processes an audio input that it can pass through unchanged.
+        //  Note: Blocks without one (-1) are silent while bypassed, the code generator does not let them be non-essential
+        virtual int getBypassInput() { return -1; };
+        // Override this function, if the block has parameters that can be changed while running.
+        //  Note: Called from the audio callback, between two handle() calls, with the changes posted to the ParamQueue
+        virtual void setParameter(int param, float value){};
         float *getOutputChannel(int channelNumber)
         {
             return out->getChannel(channelNumber);
         }
+        // Let an output channel write into memory provided by the caller, e.g. the shared buffer pool
+        void setOutputReference(float *outputRef, int channelNumber)
+        {
+            out->assignChannel(outputRef, channelNumber);
+        }
+        // Point all outputs not set with setOutputReference to unusedRef and free the block's own output memory
+        void setUnusedOutputReferences(float *unusedRef)
+        {
+            out->assignRemainingChannels(unusedRef);
+        }
         void setInputReference(float *inputRef, int channelNumber)
         {
             this->inputChannels[channelNumber] = inputRef;
@@ -112,21 +211,48 @@ namespace dspblock
         {
             return this->inputChannels[channelNumber];
         }
+        int getNumInputs()
+        {
+            return numInputs;
+        }
+        int getNumOutputs()
+        {
+            return out->getNumChannels();
+        }
+        // Control-rate blocks only compute the first sample of their outputs, once per block.
+        //  Note: Set by the codegen, only if all inputs are control-rate and all consumers only read the first sample
+        void setControlRate(bool controlRate)
+        {
+            this->controlRate = controlRate;
+        }
+        bool isControlRate()
+        {
+            return controlRate;
+        }
 
     protected:
+        // Amount of samples handle() has to compute per channel, 1 for control-rate blocks
+        int samplesToProcess()
+        {
+            return controlRate ? 1 : bufferLength;
+        }
+
         MultiChannelBuffer *out;
         int bufferLength;
+        int numInputs;
         float **inputChannels;
+        bool controlRate = false;
     };
 
     /**
      * Block to integrate physical knobs.
      * Assign the knob (0 - 3) using the constructor. Also please assign each knob only once.
+     * The knob is not read in the audio callback, its value is posted by the main loop (parameter 0, see ParamQueue).
      * 0 Inputs.
      * 1 Output:
      * - channel 0: knob value (0 - 1), its read only once per block, so all samples in this channel should be equal
      */
-    class KnobMap : public DspBlock
+    class KnobMap final : public DspBlock
     {
     public:
         KnobMap(Dubby &dubby, int knobNumber, int bufferLength) : DspBlock(0, 1, bufferLength), dubby(dubby)
@@ -136,32 +262,42 @@ namespace dspblock
         ~KnobMap() = default;
         void initialize(float samplerate) override{};
         void handle() override;
+        void setParameter(int param, float value) override
+        {
+            if (param == 0)
+            {
+                this->value = value;
+            }
+        };
 
     protected:
         Dubby::Ctrl knob;
         Dubby &dubby;
+        float value = 0;
     };
 
-    class DubbyKnobs : public DspBlock
+    class DubbyKnobs final : public DspBlock
     {
     public:
-        DubbyKnobs(Dubby &dubby, int bufferLength) : DspBlock(0, 4, bufferLength), dubby(dubby)
-        {
-            knobs = new Dubby::Ctrl[4];
-            knobs[0] = static_cast<Dubby::Ctrl>(0);
-            knobs[1] = static_cast<Dubby::Ctrl>(1);
-            knobs[2] = static_cast<Dubby::Ctrl>(2);
-            knobs[3] = static_cast<Dubby::Ctrl>(3);
-        };
+        DubbyKnobs(Dubby &dubby, int bufferLength) : DspBlock(0, 4, bufferLength), dubby(dubby){};
+        ~DubbyKnobs() = default;
         void initialize(float samplerate) override{};
         void handle() override;
+        // The value of knob param (0 - 3), posted by the main loop
+        void setParameter(int param, float value) override
+        {
+            if (param >= 0 && param < 4)
+            {
+                values[param] = value;
+            }
+        };
 
     protected:
-        Dubby::Ctrl *knobs;
         Dubby &dubby;
+        float values[4] = {0};
     };
 
-    class DubbyAudioIns : public DspBlock
+    class DubbyAudioIns final : public DspBlock
     {
     public:
         DubbyAudioIns(int bufferLength) : DspBlock(0, 4, bufferLength){};
@@ -178,7 +314,7 @@ namespace dspblock
      * 1 Output:
      * - channel 0: 0s, when no tick is produced, 1 for every tick
      */
-    class Clock : public DspBlock
+    class Clock final : public DspBlock
     {
     public:
         Clock(int bufferLength) : DspBlock(1, 1, bufferLength)
@@ -202,7 +338,7 @@ namespace dspblock
      * 1 Output:
      * - oscillator output (-1 - 1)
      */
-    class Osc : public DspBlock
+    class Osc final : public DspBlock
     {
     public:
         Osc(int bufferLenth);
@@ -217,7 +353,7 @@ namespace dspblock
     /**
      * ADSR Envelope using DaisySPs implementation.
      * Call initialize.
-     * 4 Input:
+     * 5 Input:
      * - channel 0: trigger
      * - channel 1: attack in seconds
      * - channel 2: decay in seconds
@@ -226,10 +362,10 @@ namespace dspblock
      * 1 Output:
      * - envelope output (0 - 1)
      */
-    class ADSREnv : public DspBlock
+    class ADSREnv final : public DspBlock
     {
     public:
-        ADSREnv(int bufferLength) : DspBlock(4, 1, bufferLength){};
+        ADSREnv(int bufferLength) : DspBlock(5, 1, bufferLength){};
         ~ADSREnv() = default;
         void initialize(float samplerate) override;
         void handle() override;
@@ -240,23 +376,27 @@ namespace dspblock
 
     /**
      * Simple feedback delay.
-     * Assign length in samples in the constructor.
+     * Assign length in samples in the constructor. The delay line is taken from the LARGE region of BlockMemory.
      * 2 Inputs:
      * - channel 0: audio in
      * - channel 1: dry/wet mix with 0 being only dry and 1 being only wet signal
      * 1 Output:
      * - the (wet) signal
      */
-    class FeedbackDelay : public DspBlock
+    class FeedbackDelay final : public DspBlock
     {
     public:
         FeedbackDelay(int lengthSamples, int bufferLength) : DspBlock(2, 1, bufferLength)
         {
-            this->circBuf = new float[lengthSamples];
+            this->circBuf = BlockMemory::Allocate<float>(lengthSamples, BlockMemory::LARGE);
             this->circBufPos = 0;
             this->delayLengthSamples = lengthSamples;
         };
-        ~FeedbackDelay() = default;
+        ~FeedbackDelay()
+        {
+            BlockMemory::Release(circBuf);
+        };
+        int getBypassInput() override { return 0; };
         void initialize(float samplerate) override;
         void handle() override;
 
@@ -266,6 +406,35 @@ namespace dspblock
         int delayLengthSamples;
     };
 
+    /**
+     * z^-1 of a whole audio block, the only way to route a signal back to a block running earlier (feedback).
+     * handle() outputs what latch() stored in the previous callback, so the code generator runs it before every
+     * other block, without waiting for its input. latch() runs after all handle() calls of the callback.
+     * 1 Input:
+     * - channel 0: the signal to delay
+     * 1 Output:
+     * - the input of the previous callback, silence in the first one
+     */
+    class BlockDelay final : public DspBlock
+    {
+    public:
+        BlockDelay(int bufferLength) : DspBlock(1, 1, bufferLength)
+        {
+            this->state = BlockMemory::Allocate<float>(bufferLength);
+        };
+        ~BlockDelay()
+        {
+            BlockMemory::Release(state);
+        };
+        void initialize(float samplerate) override;
+        void handle() override;
+        // Stores the input for the next callback
+        void latch();
+
+    private:
+        float *state;
+    };
+
     /**
      * Block to store a constant value.
      * Assing the constant value using the constructor.
@@ -275,7 +444,7 @@ namespace dspblock
      * 1 Outpus:
      * - a buffer consisting of the same constant value, everytime.
      */
-    class ConstValue : public DspBlock
+    class ConstValue final : public DspBlock
     {
     public:
         // Constructor that automatically initializes DspBlock with a fixed inputVector and one channel
@@ -286,6 +455,8 @@ namespace dspblock
         ~ConstValue() = default;
         void initialize(float samplerate) override;
         void handle() override{};
+        // Parameter 0 replaces the value
+        void setParameter(int param, float value) override;
 
     private:
         float val;
@@ -304,73 +475,49 @@ namespace dspblock
      * 1 output:
      * - the result of the multiplication
      */
-    class NMultiplier : public DspBlock
+    class NMultiplier final : public DspBlock
     {
     public:
-        NMultiplier(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength)
-        {
-            this->numInputs = numInputs;
-        };
+        NMultiplier(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength){};
         ~NMultiplier() = default;
         void initialize(float samplerate) override{};
         void handle() override;
-
-    private:
-        int numInputs;
     };
 
     //-----Summation----//
     // Add n diferent channel input values and outputs the result
-    class Sum : public DspBlock
+    class Sum final : public DspBlock
     {
     public:
-        Sum(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength)
-        {
-            this->numInputs = numInputs;
-        };
+        Sum(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength){};
         ~Sum() = default;
         void initialize(float samplerate) override{};
         void handle() override;
-
-    private:
-        int numInputs;
     };
 
     //---Subtraction----/
-    // Subtract n diferent channel input values and outputs the result
-    class Sub : public DspBlock
+    // Subtracts the channels 1..n-1 from channel 0 and outputs the result
+    class Sub final : public DspBlock
     {
     public:
-        Sub(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength)
-        {
-            this->numInputs = numInputs;
-        };
+        Sub(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength){};
         ~Sub() = default;
         void initialize(float samplerate) override{};
         void handle() override;
-
-    private:
-        int numInputs;
     };
 
     //---Division----//
-    // Divides n diferent channel input values and outputs the result
-    class Div : public DspBlock
+    // Divides channel 0 by the channels 1..n-1 and outputs the result
+    class Div final : public DspBlock
     {
     public:
-        Div(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength)
-        {
-            this->numInputs = numInputs;
-        };
+        Div(int numInputs, int bufferLength) : DspBlock(numInputs, 1, bufferLength){};
         ~Div() = default;
         void initialize(float samplerate) override{};
         void handle() override;
-
-    private:
-        int numInputs;
     };
 
-    class Scaler : public DspBlock
+    class Scaler final : public DspBlock
     {
     public:
         Scaler(float inMin, float inMax, float outMin, float outMax, int bufferLength) : DspBlock(1, 1, bufferLength)
@@ -397,7 +544,7 @@ namespace dspblock
      * 1 output:
      * - the absolute / unipolar signal
      */
-    class Unipolariser : public DspBlock
+    class Unipolariser final : public DspBlock
     {
     public:
         Unipolariser(int bufferLength) : DspBlock(1, 1, bufferLength){};
@@ -406,7 +553,7 @@ namespace dspblock
         void handle() override;
     };
 
-    class VolumeControl : public DspBlock
+    class VolumeControl final : public DspBlock
     {
     public:
         VolumeControl(int bufferLength) : DspBlock(2, 1, bufferLength){};
@@ -416,12 +563,11 @@ namespace dspblock
         void handle() override;
     };
 
-    class Mix : public DspBlock
+    class Mix final : public DspBlock
     {
     public:
         Mix(int numInputs, int numOutputs, int bufferLength) : DspBlock(numInputs, numOutputs, bufferLength)
         {
-            this->numInputs = numInputs;
             this->numOutputs = numOutputs;
         }
         ~Mix() = default;
@@ -429,14 +575,13 @@ namespace dspblock
         void handle() override;
 
     private:
-        int numInputs;
         int numOutputs;
     };
 
     //  ------- white noise generator-------
     // This
 
-    class NoiseGen : public DspBlock
+    class NoiseGen final : public DspBlock
     {
     public:
         NoiseGen(int bufferLenth);
@@ -451,13 +596,16 @@ namespace dspblock
     // then the block converts the musical time into time in samples depending on BPM
     // Half Note = 2, Quarter Note = 1, Eigth Note = 0.5, Sixteenth Note = 0.25;
     // Dotted Off = 0; Dotted On = 1;
-    class MusicalTime : public DspBlock {
+    class MusicalTime final : public DspBlock {
     public:
         MusicalTime(int bufferlength) : DspBlock(3,1,bufferlength){};
         ~MusicalTime() = default;
-        void initialize(float samplerate) override{};
+        void initialize(float samplerate) override;
         void handle()override;
 
+    private:
+        float samplerate = 48000.f;
+
     }; 
 
     //----- Time in samples to HZ converter--------//
@@ -465,89 +613,169 @@ namespace dspblock
     //Example: if we want to modulate a block with a specific musical time (quarters) we have to convert
     //the samples that MusicalTime block provides to HZ that oscilator can handle. So, that what this block does.
 
-    class StoF : public DspBlock {
+    class StoF final : public DspBlock {
     public:
         StoF(int bufferlength) : DspBlock(1,1,bufferlength){};
         ~StoF() = default;
-        void initialize(float samplerate) override{};
+        void initialize(float samplerate) override;
         void handle() override;
 
+    private:
+        float samplerate = 48000.f;
+
     };
 
     //------------Filters--------
 
-    //bandPass
+    /**
+     * A cascade of identical RBJ biquad sections in transposed direct form II, the building block of the filter blocks.
+     * It is not a DspBlock itself.
+     * The coefficients are only recomputed when cutoff or quality change and are then interpolated over the next
+     * process() call, so modulating them does not click. Otherwise the whole block runs through
+     * arm_biquad_cascade_df2T_f32. The state is kept across calls.
+     */
+    class BiquadCascade
+    {
+    public:
+        enum Type
+        {
+            LOW_PASS,
+            HIGH_PASS,
+            BAND_PASS,
+            ALL_PASS
+        };
+        static const int MAX_STAGES = 4;
 
-    class BPF : public DspBlock {
+        BiquadCascade();
+        // Sets type, amount of sections (1 - MAX_STAGES, 12 dB/octave each) and sample rate and clears the state
+        void init(Type type, int stages, float samplerate = 48000.f);
+        // Sets cutoff (or center) frequency in Hz and quality, only recomputes the coefficients if they changed
+        void setParameters(float fc, float q);
+        // Filters length samples, in and out may be the same buffer
+        void process(float *in, float *out, int length);
+
+    private:
+        // Normalized coefficients {b0, b1, b2, -a1, -a2} in the order of arm_biquad_cascade_df2T_f32
+        void computeCoefficients(float fc, float q, float *coeffs);
+
+        Type type;
+        int stages;
+        float samplerate;
+        float coeffs[5 * MAX_STAGES];  // the same coefficients for every stage
+        float target[5];               // coefficients to reach by the end of the next process()
+        float state[2 * MAX_STAGES];   // {d1, d2} per stage
+        float cachedFc, cachedQ;       // cutoff and quality of target, < 0 before the first setParameters()
+        bool interpolate;              // coefficients still have to move to target
+#ifndef DAISYDUB_HOST
+        arm_biquad_cascade_df2T_instance_f32 cascade;
+#endif
+    };
+
+    /**
+     * Base of the filter blocks BPF, LPF and HPF.
+     * Several identical stages can be cascaded for a steeper slope (1 - BiquadCascade::MAX_STAGES).
+     * 3 Inputs:
+     * - channel 0: audio in
+     * - channel 1: cutoff (or center) frequency in Hz (20 - 20000, below 0.45 of the sample rate), read once per block
+     * - channel 2: quality (0.7 - 10), read once per block
+     * 1 Output:
+     * - the filtered signal
+     */
+    class BiquadFilter : public DspBlock
+    {
     public:
-        BPF(int bufferLength) : DspBlock(3, 1, bufferLength){};
-        ~BPF() = default;
-        void initialize(float samplerate) override{}; 
-        void handle() override;    
+        BiquadFilter(BiquadCascade::Type type, int stages, int bufferLength) : DspBlock(3, 1, bufferLength)
+        {
+            this->type = type;
+            this->stages = stages;
+            filter.init(type, stages);
+        };
+        ~BiquadFilter() = default;
+        void initialize(float samplerate) override;
+        void handle() override;
+        int getBypassInput() override { return 0; };
 
     private:
-    float cirBuffin[4];
-    float cirBuffout[4];
+        BiquadCascade::Type type;
+        int stages;
+        BiquadCascade filter;
     };
 
-    //------Low Pass Filter----
+    //bandPass, 0 dB at the center frequency
 
-    class LPF : public DspBlock {
+    class BPF final : public BiquadFilter {
     public:
-        LPF(int bufferLength) : DspBlock(3, 1, bufferLength){};
-        ~LPF() = default;
-        void initialize(float samplerate) override{}; 
-        void handle() override;    
+        BPF(int bufferLength) : BiquadFilter(BiquadCascade::BAND_PASS, 1, bufferLength){};
+        BPF(int stages, int bufferLength) : BiquadFilter(BiquadCascade::BAND_PASS, stages, bufferLength){};
+        ~BPF() = default;
+    };
 
-    private:
-    float cirBuffin[4];
-    float cirBuffout[4];
+    //------Low Pass Filter----
 
+    class LPF final : public BiquadFilter {
+    public:
+        LPF(int bufferLength) : BiquadFilter(BiquadCascade::LOW_PASS, 1, bufferLength){};
+        LPF(int stages, int bufferLength) : BiquadFilter(BiquadCascade::LOW_PASS, stages, bufferLength){};
+        ~LPF() = default;
     };
 
 
     //-------High Pass Filter HPF-------
 
-    class HPF : public DspBlock {
+    class HPF final : public BiquadFilter {
     public:
-        HPF(int bufferLength) : DspBlock(3, 1, bufferLength){};
+        HPF(int bufferLength) : BiquadFilter(BiquadCascade::HIGH_PASS, 1, bufferLength){};
+        HPF(int stages, int bufferLength) : BiquadFilter(BiquadCascade::HIGH_PASS, stages, bufferLength){};
         ~HPF() = default;
-        void initialize(float samplerate) override{}; 
-        void handle() override;    
-
-    private:
-    float cirBuffin[4];
-    float cirBuffout[4];
     };
     
     /* --------MultiBand Compressor---------------*/
-class MBCompressor : public DspBlock {
-public:
-    MBCompressor(int bufferLength) : DspBlock(7, 1, bufferLength){};
-    ~MBCompressor() = default;
-
-    void initialize(float samplerate) override;
-    void handle() override;
-
-private:
-    // Defining 3 bands for filter and comp
-    // LPF lpf_band1;
-    // BPF bpf_band2;
-    // HPF hpf_band3;
-    daisysp::Compressor comp_band1, comp_band2, comp_band3;
-    float cirBuffin1[4];
-    float cirBuffin2[4];
-    float cirBuffin3[4];
-    float cirBuffout1[4];
-    float cirBuffout2[4];
-    float cirBuffout3[4];
-};
 
+    /**
+     * Compressor splitting the signal into bands with Linkwitz-Riley crossovers (24 dB/octave), so the bands sum flat.
+     * Every band is compressed by its own daisysp::Compressor, all with the same settings.
+     * Assign the amount of bands (2 - MAX_BANDS) in the constructor, 3 if not given.
+     * n + 4 Inputs for n bands:
+     * - channel 0: audio in
+     * - channel 1 .. n-1: crossover frequencies in Hz, ascending
+     * - channel n: threshold in dB (-80 - 0)
+     * - channel n+1: ratio (1 - 40)
+     * - channel n+2: attack in seconds (0.001 - 10)
+     * - channel n+3: release in seconds (0.001 - 10)
+     * All but the audio in are read once per block.
+     * 1 Output:
+     * - the sum of the compressed bands
+     */
+    class MBCompressor final : public DspBlock
+    {
+    public:
+        static const int MAX_BANDS = 4;
 
+        MBCompressor(int bufferLength) : MBCompressor(3, bufferLength){};
+        MBCompressor(int numBands, int bufferLength);
+        ~MBCompressor()
+        {
+            BlockMemory::Release(bandBuffers);
+        };
+
+        void initialize(float samplerate) override;
+        void handle() override;
+        int getBypassInput() override { return 0; };
+
+    private:
+        int numBands;
+        float *bandBuffers; // numBands * bufferLength
+        float crossovers[MAX_BANDS - 1];
+        float thr, ratio, attack, release; // current compressor settings, < 0 before the first block
+        BiquadCascade lowPass[MAX_BANDS - 1], highPass[MAX_BANDS - 1];
+        // Band k passes the crossovers k-1 and k, it gets an allpass for every crossover above to stay in phase
+        BiquadCascade allPass[MAX_BANDS][MAX_BANDS - 1];
+        daisysp::Compressor compressors[MAX_BANDS];
+    };
 
     /* --------Compressor---------------*/
 
-    class Compressor : public DspBlock
+    class Compressor final : public DspBlock
     {
     public:
         Compressor(int bufferLength) : DspBlock(5, 1, bufferLength){};
@@ -555,6 +783,7 @@ private:
 
         void initialize(float samplerate) override;
         void handle() override;
+        int getBypassInput() override { return 0; };
 
     private:
         daisysp::Compressor compressor;
@@ -0,0 +1,131 @@
+#pragma once
+#include <cmath>
+#ifndef DAISYDUB_HOST
+#include "arm_math.h"
+#endif
+
+namespace dspblock
+{
+    /**
+     * Block-wise vector kernels for the math DspBlocks.
+     * On the Daisy they call CMSIS-DSP (its sources are built by the Makefile of the firmware),
+     * on the host they are plain loops the compiler can vectorize.
+     * Like in CMSIS-DSP, dst may be the same buffer as the (first) source, so a result can be accumulated in place.
+     * n is the amount of samples, e.g. samplesToProcess()
+     */
+    namespace kernels
+    {
+        // dst[i] = a[i] * b[i]
+        inline void multiply(float *a, float *b, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] * b[i];
+            }
+#else
+            arm_mult_f32(a, b, dst, n);
+#endif
+        }
+
+        // dst[i] = a[i] + b[i]
+        inline void add(float *a, float *b, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] + b[i];
+            }
+#else
+            arm_add_f32(a, b, dst, n);
+#endif
+        }
+
+        // dst[i] = a[i] - b[i]
+        inline void subtract(float *a, float *b, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] - b[i];
+            }
+#else
+            arm_sub_f32(a, b, dst, n);
+#endif
+        }
+
+        // dst[i] = a[i] / b[i], CMSIS-DSP has no float division
+        inline void divide(float *a, float *b, float *dst, int n)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] / b[i];
+            }
+        }
+
+        // dst[i] = a[i] * scale
+        inline void scale(float *a, float scale, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] * scale;
+            }
+#else
+            arm_scale_f32(a, scale, dst, n);
+#endif
+        }
+
+        // dst[i] = a[i] + offset
+        inline void offset(float *a, float offset, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i] + offset;
+            }
+#else
+            arm_offset_f32(a, offset, dst, n);
+#endif
+        }
+
+        // dst[i] = |a[i]|
+        inline void absolute(float *a, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = std::fabs(a[i]);
+            }
+#else
+            arm_abs_f32(a, dst, n);
+#endif
+        }
+
+        // dst[i] = a[i], a and dst must not overlap
+        inline void copy(float *a, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = a[i];
+            }
+#else
+            arm_copy_f32(a, dst, n);
+#endif
+        }
+
+        // dst[i] = value
+        inline void fill(float value, float *dst, int n)
+        {
+#ifdef DAISYDUB_HOST
+            for (int i = 0; i < n; i++)
+            {
+                dst[i] = value;
+            }
+#else
+            arm_fill_f32(value, dst, n);
+#endif
+        }
+    }
+}
@@ -33,6 +33,9 @@ using namespace daisy;
 #define SUBMENU_Y_START 1
 #define SUBMENU_Y_END 11
 
+// The physical outputs are the outputs of the patch scaled by 0.25, a full bar is a level of 1 in the patch
+#define METER_FULL_SCALE 0.25f
+
 void Dubby::Init() 
 {
     InitControls();
@@ -97,13 +100,15 @@ void Dubby::InitGates()
 void Dubby::InitDisplay() 
 {
     /** Configure the Display */
-    OledDisplay<SSD130x4WireSpi128x64Driver>::Config disp_cfg;
-    disp_cfg.driver_config.transport_config.pin_config.dc    = seed.GetPin(9);
-    disp_cfg.driver_config.transport_config.pin_config.reset = seed.GetPin(31);
+    DubbyDisplay::Config disp_cfg;
+    disp_cfg.transport_config.pin_config.dc    = seed.GetPin(9);
+    disp_cfg.transport_config.pin_config.reset = seed.GetPin(31);
     /** And Initialize */
     display.Init(disp_cfg);
 }
 
+// Menu changes are drawn right away, the panes that follow the audio and knobs once per frame.
+// The display is sent at most once per frame and only where it changed, see DubbyDisplay
 void Dubby::UpdateDisplay() 
 {
     if (encoder.TimeHeldMs() > 300) 
@@ -117,20 +122,16 @@ void Dubby::UpdateDisplay()
         if (encoder.Increment()) UpdateMenu(encoder.Increment(), true);
     } 
 
-    switch(menuItemSelected) 
+    if (menuItemSelected == MENU1 && encoder.Increment() && !menuActive) UpdateScopeWindow(encoder.Increment());
+
+#ifdef DUBBY_PROFILE
+    if (menuItemSelected == MENU4 && encoder.RisingEdge()) profiler.Reset();
+#endif
+
+    if (menuItemSelected == MENU3)
     {
-        case MENU1:
-            RenderScope();
-            break;
-        case MENU2:
-            UpdateMixerPane();
-            break;
-        case MENU3:
-            if (encoder.Pressed() && preferencesMenuItemSelected == OPTION4) ResetToBootloader();
-            if (encoder.Increment() && !menuActive) UpdatePreferencesMenu(encoder.Increment());
-            break;
-        default:
-            break;
+        if (encoder.Pressed() && preferencesMenuItemSelected == OPTION4) ResetToBootloader();
+        if (encoder.Increment() && !menuActive) UpdatePreferencesMenu(encoder.Increment());
     }
     
     if (encoder.TimeHeldMs() < 300 && menuActive)
@@ -140,6 +141,30 @@ void Dubby::UpdateDisplay()
         ReleaseMenu();
         UpdateSubmenu();
     }
+
+    if(seed.system.GetNow() - screen_update_last_ > screen_update_period_)
+    {
+        screen_update_last_ = seed.system.GetNow();
+        metering.Update(screen_update_last_);
+        switch(menuItemSelected) 
+        {
+            case MENU1:
+                RenderScope();
+                break;
+            case MENU2:
+                UpdateMixerPane();
+                break;
+#ifdef DUBBY_PROFILE
+            case MENU4:
+                RenderProfile();
+                break;
+#endif
+            default:
+                break;
+        }
+        if (menuItemSelected != MENU3) DrawOverruns();
+        display.Update();
+    }
 }
 
 void Dubby::DrawLogo() 
@@ -170,15 +195,15 @@ void Dubby::DrawBitmap(int bitmapIndex)
 
                 display.DrawPixel(x + bitIndex, y, isWhite);
             }
-
-            if (y % 6 == 0) display.Update();
         }
     }
+
+    display.Update();
 }
 
 void Dubby::UpdateMenu(int increment, bool higlight) 
 {
-    if ((menuItemSelected >= 0 && increment == 1 && menuItemSelected < 2) || (increment != 1 && menuItemSelected != 0))
+    if ((menuItemSelected >= 0 && increment == 1 && menuItemSelected < MENU_LAST - 1) || (increment != 1 && menuItemSelected != 0))
         menuItemSelected = (MenuItems)(menuItemSelected + increment);
 
     display.Fill(false);
@@ -187,23 +212,19 @@ void Dubby::UpdateMenu(int increment, bool higlight)
     else ReleaseMenu();
     
     UpdateSubmenu();
-
-    display.Update();
 }
 
 void Dubby::HightlightMenuItem() 
 {
     display.DrawRect(menuBoxBounding[menuItemSelected][0], menuBoxBounding[menuItemSelected][1], menuBoxBounding[menuItemSelected][2], menuBoxBounding[menuItemSelected][3], true, true);
 
-    for (int i = 0; i < 3; i++) 
+    for (int i = 0; i < MENU_LAST; i++) 
     {
         display.SetCursor(menuTextCursors[i][0], menuTextCursors[i][1]);
         display.WriteString(GetTextForEnum(MAINMENU, i), Font_6x8, i == menuItemSelected ? false : true);
     }
 
     display.DrawRect(PANE_X_START - 1, PANE_Y_START - 1, PANE_X_END + 1, PANE_Y_END + 1, true);
-
-    display.Update();
 }
 
 void Dubby::ReleaseMenu() 
@@ -216,17 +237,11 @@ void Dubby::ReleaseMenu()
         display.SetCursor(menuTextCursors[i][0], menuTextCursors[i][1]);
         display.WriteString(GetTextForEnum(MAINMENU, i), Font_6x8, true);
     }
-
-    display.Update();
 }
 
 void Dubby::UpdateMixerPane() 
 {
-    if(seed.system.GetNow() - screen_update_last_ > screen_update_period_)
-    {
-        screen_update_last_ = seed.system.GetNow();
-        for (int i = 0; i < 4; i++) UpdateBar(i);
-    }
+    for (int i = 0; i < 4; i++) UpdateBar(i);
 }
 
 void Dubby::UpdateSubmenu()
@@ -242,49 +257,117 @@ void Dubby::UpdateSubmenu()
         case MENU3:
             DisplayPreferencesMenu();
             break;
+#ifdef DUBBY_PROFILE
+        case MENU4:
+            RenderProfile();
+            break;
+#endif
         default:
             break;
     }
+}
 
-    display.Update();
+// Row of a bar of the mixer pane for a value from 0 (bottom) to 1 (top)
+static int BarY(float value)
+{
+    return int((1.0f - std::min(std::max(value, 0.f), 1.f)) * 50.0f) + 1;
 }
 
+// The knob as a frame, the RMS level of the output filled and its held peak as a line
 void Dubby::UpdateBar(int i) 
 {
-    display.DrawRect((i * 32)  + margin, 1, ((i + 1) * 31) - margin, 51, false, true);
-    display.DrawRect((i * 32)  + margin, int(abs(1.0f - GetKnobValue(static_cast<Dubby::Ctrl>(i))) * 51.0f) + 1, ((i + 1) * 31) - margin, 51, true, false);
-    display.DrawRect((i * 32)  + margin, int(abs((currentLevels[i] * 5.0f) - 1.0f) * 51.0f) + 1, ((i + 1) * 31) - margin, 51, true, true);
-    
-    display.Update();
+    int left = (i * 32) + margin;
+    int right = ((i + 1) * 31) - margin;
+    display.DrawRect(left, 1, right, 51, false, true);
+    display.DrawRect(left, BarY(GetKnobValue(static_cast<Dubby::Ctrl>(i))), right, 51, true, false);
+    display.DrawRect(left, BarY(metering.GetRms(i) / METER_FULL_SCALE), right, 51, true, true);
+    int peakY = BarY(metering.GetPeakHold(i) / METER_FULL_SCALE);
+    display.DrawLine(left, peakY, right, peakY, true);
 }
 
 void Dubby::RenderScope()
 {
-    if(seed.system.GetNow() - screen_update_last_ > screen_update_period_)
+    static float samples[OLED_WIDTH - 2];
+    // Keeps the last frame while the audio has not written enough yet
+    if (!metering.GetScope(samples, OLED_WIDTH - 2)) return;
+
+    display.DrawRect(PANE_X_START, PANE_Y_START, PANE_X_END, PANE_Y_END, false, true);
+    int prev_x = 0;
+    int prev_y = (OLED_HEIGHT - 15) / 2;
+    for(int i = 0; i < OLED_WIDTH - 2; i++)
     {
-        screen_update_last_ = seed.system.GetNow();
-        display.DrawRect(PANE_X_START, PANE_Y_START, PANE_X_END, PANE_Y_END, false, true);
-        int prev_x = 0;
-        int prev_y = (OLED_HEIGHT - 15) / 2;
-        for(size_t i = 0; i < AUDIO_BLOCK_SIZE; i++)
+        int y = 1 + std::min(std::max((OLED_HEIGHT - 15) / 2
+                                    - int(samples[i] * (OLED_HEIGHT - 15) / 2),
+                                0),
+                        OLED_HEIGHT - 15);
+        int x = 1 + i;
+        if(i != 0)
         {
-            int y = 1 + std::min(std::max((OLED_HEIGHT - 15) / 2
-                                        - int(scope_buffer[i] * 150),
-                                    0),
-                            OLED_HEIGHT - 15);
-            int x = 1 + i * (OLED_WIDTH - 2) / AUDIO_BLOCK_SIZE;
-            if(i != 0)
-            {
-                display.DrawLine(prev_x, prev_y, x, y, true);
-            }
-            prev_x = x;
-            prev_y = y;
+            display.DrawLine(prev_x, prev_y, x, y, true);
         }
+        prev_x = x;
+        prev_y = y;
+    }
 
-        display.Update();
-    }   
+    char window[12];
+    sprintf(window, "%dms", (int)((OLED_WIDTH - 2) * metering.GetScopeDecimation() * 1000 / seed.AudioSampleRate()));
+    display.SetCursor(PANE_X_START + 1, PANE_Y_START + 1);
+    display.WriteString(window, Font_6x8, true);
+}
+
+void Dubby::UpdateScopeWindow(int increment)
+{
+    int decimation = metering.GetScopeDecimation();
+    metering.SetScopeDecimation(increment > 0 ? decimation * 2 : decimation / 2);
 }
 
+void Dubby::DrawOverruns()
+{
+    const uint32_t count = overruns.GetOverruns() + overruns.GetMissedBlocks();
+    if (count == 0) return;
+
+    char text[16];
+    int length = snprintf(text, sizeof(text), "XRUN %lu", (unsigned long)count);
+    const int x = PANE_X_END - length * 6 - 1;
+    const bool degraded = overruns.IsDegraded();
+    display.DrawRect(x - 1, PANE_Y_START, PANE_X_END, PANE_Y_START + 9, degraded, true);
+    display.SetCursor(x, PANE_Y_START + 1);
+    display.WriteString(text, Font_6x8, !degraded);
+}
+
+#ifdef DUBBY_PROFILE
+void Dubby::RenderProfile()
+{
+    // One line for the callback, then the nodes with the highest average load
+    const int maxTop = (PANE_Y_END - PANE_Y_START) / 10 - 1;
+    int top[maxTop];
+    int numTop = 0;
+    for (int n = 0; n < profiler.GetNumNodes(); n++)
+    {
+        int i = numTop < maxTop ? numTop++ : maxTop;
+        for (; i > 0 && profiler.GetNodeStats(top[i - 1]).avg < profiler.GetNodeStats(n).avg; i--)
+        {
+            if (i < maxTop) top[i] = top[i - 1];
+        }
+        if (i < maxTop) top[i] = n;
+    }
+
+    display.DrawRect(PANE_X_START, PANE_Y_START, PANE_X_END, PANE_Y_END, false, true);
+    char line[24];
+    const NodeProfiler::Stats &callback = profiler.GetCallbackStats();
+    sprintf(line, "CPU %3d%% max %3d%%", int(profiler.GetLoad(callback.avg) * 100), int(profiler.GetLoad(callback.max) * 100));
+    display.SetCursor(PANE_X_START + 1, PANE_Y_START + 1);
+    display.WriteString(line, Font_6x8, true);
+    for (int i = 0; i < numTop; i++)
+    {
+        const NodeProfiler::Stats &stats = profiler.GetNodeStats(top[i]);
+        sprintf(line, "%-9.9s%3d%% %3d%%", profiler.GetNodeName(top[i]), int(profiler.GetLoad(stats.avg) * 100), int(profiler.GetLoad(stats.max) * 100));
+        display.SetCursor(PANE_X_START + 1, PANE_Y_START + 1 + (i + 1) * 10);
+        display.WriteString(line, Font_6x8, true);
+    }
+}
+#endif
+
 void Dubby::DisplayPreferencesMenu()
 {
     display.DrawRect(PANE_X_START, PANE_Y_START, PANE_X_END, PANE_Y_END, false, true);
@@ -297,8 +380,6 @@ void Dubby::DisplayPreferencesMenu()
         if (preferencesMenuItemSelected == i)
             display.DrawRect(submenuBoxBounding[i][0], submenuBoxBounding[i][1], submenuBoxBounding[i][2], submenuBoxBounding[i][3], true);
     }
-
-    display.Update();
 }
 
 void Dubby::UpdatePreferencesMenu(int increment) 
@@ -318,7 +399,8 @@ void Dubby::ResetToBootloader()
     display.SetCursor(20, 55);
     display.WriteString("FIRMWARE UPDATE", Font_6x8, true);
 
-    display.Update();
+    // The transfer must be done before the reset
+    display.Flush();
 
     System::ResetToBootloader();
 }
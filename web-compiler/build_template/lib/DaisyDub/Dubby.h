@@ -1,12 +1,18 @@
 
 #pragma once
 #include "daisy_seed.h"
-#include "dev/oled_ssd130x.h"
+#include "DubbyDisplay.h"
+#include "Metering.h"
+#include "NodeProfiler.h"
+#include "OverrunMonitor.h"
 
 
 #include "./bitmaps/bmps.h"
 
-#define AUDIO_BLOCK_SIZE 128 
+// Samples per audio callback. The generated firmware defines it per patch ("blockSize") before including this
+#ifndef AUDIO_BLOCK_SIZE
+#define AUDIO_BLOCK_SIZE 128
+#endif
 
 namespace daisy
 {
@@ -19,6 +25,9 @@ class Dubby
         MENU1, 
         MENU2, 
         MENU3,
+#ifdef DUBBY_PROFILE
+        MENU4,
+#endif
         MENU_LAST // used to know the size of enum
     };
     
@@ -26,7 +35,10 @@ class Dubby
     { 
         "SCOPE", 
         "MIXER", 
-        "PREFS" 
+        "PREFS",
+#ifdef DUBBY_PROFILE
+        "PROF",
+#endif
     };
     
     enum PreferenesMenuItems 
@@ -99,6 +111,17 @@ class Dubby
 
     void RenderScope();
 
+    // Turning the encoder on the scope pane doubles or halves its window
+    void UpdateScopeWindow(int increment);
+
+    // Count of late callbacks in the corner of the pane, inverted while the patch is degraded
+    void DrawOverruns();
+
+#ifdef DUBBY_PROFILE
+    // Load of the callback and of the most expensive nodes, pressing the encoder resets their maximums
+    void RenderProfile();
+#endif
+
     void DisplayPreferencesMenu();
 
     void UpdatePreferencesMenu(int increment);
@@ -121,19 +144,32 @@ class Dubby
     
     PreferenesMenuItems preferencesMenuItemSelected = (PreferenesMenuItems)0;
 
-    const int menuTextCursors[3][2] = { {8, 55}, {50, 55}, {92, 55} }; 
-    const int menuBoxBounding[3][4] = { {0, 53, 43, 63}, {43, 53, 85, 63}, {85, 53, 127, 63} }; 
+#ifdef DUBBY_PROFILE
+    const int menuTextCursors[MENU_LAST][2] = { {2, 55}, {34, 55}, {66, 55}, {100, 55} }; 
+    const int menuBoxBounding[MENU_LAST][4] = { {0, 53, 32, 63}, {32, 53, 64, 63}, {64, 53, 96, 63}, {96, 53, 127, 63} }; 
+#else
+    const int menuTextCursors[MENU_LAST][2] = { {8, 55}, {50, 55}, {92, 55} }; 
+    const int menuBoxBounding[MENU_LAST][4] = { {0, 53, 43, 63}, {43, 53, 85, 63}, {85, 53, 127, 63} }; 
+#endif
     int submenuBoxBounding[5][4];
 
     Encoder encoder;   
     AnalogControl analogInputs[CTRL_LAST];
     GateIn gateInputs[GATE_IN_LAST];  
 
-    float scope_buffer[AUDIO_BLOCK_SIZE] = {0.f};
-    
-    float currentLevels[4] = { 0.f };
+    // Levels of the outputs and the scope, written by the audio callback
+    Metering metering;
+
+    // Callbacks that did not finish in time, see the generated AudioCallback
+    OverrunMonitor overruns;
+
+#ifdef DUBBY_PROFILE
+    // Cycles of the nodes of the patch, filled by the generated AudioCallback
+    NodeProfiler profiler;
+#endif
 
-    OledDisplay<SSD130x4WireSpi128x64Driver> display;
+    // Drawing only changes its framebuffer, UpdateDisplay() sends the changes once per frame
+    DubbyDisplay display;
 
   private:
 
@@ -0,0 +1,162 @@
+#include "DubbyDisplay.h"
+
+using namespace daisy;
+
+// The rectangle being sent: COMMAND_SIZE bytes of commands, then its pages one after another. Not cached, for the DMA
+static uint8_t DMA_BUFFER_MEM_SECTION txBuffer[DubbyDisplay::COMMAND_SIZE + DubbyDisplay::WIDTH * DubbyDisplay::PAGES];
+
+void DubbyDisplay::Init(Config config)
+{
+    const SSD130x4WireSpiTransport::Config &transport = config.transport_config;
+    pinDc.mode = DSY_GPIO_MODE_OUTPUT_PP;
+    pinDc.pin  = transport.pin_config.dc;
+    dsy_gpio_init(&pinDc);
+    pinReset.mode = DSY_GPIO_MODE_OUTPUT_PP;
+    pinReset.pin  = transport.pin_config.reset;
+    dsy_gpio_init(&pinReset);
+
+    spi.Init(transport.spi_config);
+
+    dsy_gpio_write(&pinReset, 0);
+    System::Delay(10);
+    dsy_gpio_write(&pinReset, 1);
+    System::Delay(10);
+
+    // As SSD130xDriver for 128x64
+    const uint8_t init[] = {
+        0xAE,       // display off
+        0xD5, 0x80, // display clock divide ratio
+        0xA8, 0x3F, // multiplex ratio
+        0xDA, 0x12, // COM pins
+        0xD3, 0x00, // display offset
+        0x40,       // start line address
+        0xA6,       // normal display
+        0xA4,       // all on resume
+        0x8D, 0x14, // charge pump
+        0xA1,       // segment remap
+        0xC8,       // COM output scan direction
+        0x81, 0x8F, // contrast control
+        0xD9, 0x25, // pre charge
+        0xDB, 0x34, // VCOM detect
+        0x20, 0x00, // horizontal addressing, so a rectangle set by 0x21 and 0x22 is written in one transfer
+        0xAF,       // display on
+    };
+    for (uint8_t cmd : init) SendCommand(cmd);
+
+    // The content of the display is unknown
+    Fill(false);
+    MarkAllDirty();
+}
+
+void DubbyDisplay::SendCommand(uint8_t cmd)
+{
+    dsy_gpio_write(&pinDc, 0);
+    spi.BlockingTransmit(&cmd, 1);
+}
+
+void DubbyDisplay::Fill(bool on)
+{
+    const uint8_t value = on ? 0xFF : 0x00;
+    for (int i = 0; i < WIDTH * PAGES; i++)
+    {
+        if (buffer[i] != value)
+        {
+            buffer[i] = value;
+            MarkDirty(i / WIDTH, i % WIDTH);
+        }
+    }
+}
+
+void DubbyDisplay::DrawPixel(uint_fast8_t x, uint_fast8_t y, bool on)
+{
+    if (x >= WIDTH || y >= HEIGHT) return;
+
+    uint8_t &byte = buffer[x + (y / 8) * WIDTH];
+    const uint8_t value = on ? byte | (1 << (y % 8)) : byte & ~(1 << (y % 8));
+    // Redrawing the same content (e.g. clearing and drawing a pane every frame) leaves it clean
+    if (value == byte) return;
+    byte = value;
+    MarkDirty(y / 8, x);
+}
+
+void DubbyDisplay::Update()
+{
+    if (busy) return;
+    if (failed)
+    {
+        failed = false;
+        MarkAllDirty();
+    }
+    if (dirtyPageMax < 0) return;
+
+    const int columns = dirtyColumnMax - dirtyColumnMin + 1;
+    uint8_t *data = txBuffer + COMMAND_SIZE;
+    for (int page = dirtyPageMin; page <= dirtyPageMax; page++)
+    {
+        memcpy(data, &buffer[page * WIDTH + dirtyColumnMin], columns);
+        data += columns;
+    }
+    txBuffer[0] = 0x21; // column address
+    txBuffer[1] = dirtyColumnMin;
+    txBuffer[2] = dirtyColumnMax;
+    txBuffer[3] = 0x22; // page address
+    txBuffer[4] = dirtyPageMin;
+    txBuffer[5] = dirtyPageMax;
+    txSize = data - txBuffer - COMMAND_SIZE;
+
+    dirtyPageMin = PAGES;
+    dirtyPageMax = -1;
+    dirtyColumnMin = WIDTH;
+    dirtyColumnMax = -1;
+
+    busy = true;
+    if (spi.DmaTransmit(txBuffer, COMMAND_SIZE, StartCommands, EndCommands, this) != SpiHandle::Result::OK)
+    {
+        // Not started, so no callback clears busy. The next Update() sends the whole framebuffer again
+        failed = true;
+        busy = false;
+    }
+}
+
+void DubbyDisplay::Flush()
+{
+    while (busy) {}
+    Update();
+    while (busy) {}
+}
+
+void DubbyDisplay::StartCommands(void *context)
+{
+    dsy_gpio_write(&static_cast<DubbyDisplay *>(context)->pinDc, 0);
+}
+
+void DubbyDisplay::EndCommands(void *context, SpiHandle::Result result)
+{
+    DubbyDisplay *display = static_cast<DubbyDisplay *>(context);
+    if (result != SpiHandle::Result::OK)
+    {
+        display->failed = true;
+        display->busy = false;
+        return;
+    }
+    if (display->spi.DmaTransmit(txBuffer + COMMAND_SIZE, display->txSize, StartData, EndData, context) != SpiHandle::Result::OK)
+    {
+        display->failed = true;
+        display->busy = false;
+    }
+}
+
+void DubbyDisplay::StartData(void *context)
+{
+    dsy_gpio_write(&static_cast<DubbyDisplay *>(context)->pinDc, 1);
+}
+
+void DubbyDisplay::EndData(void *context, SpiHandle::Result result)
+{
+    DubbyDisplay *display = static_cast<DubbyDisplay *>(context);
+    if (result != SpiHandle::Result::OK)
+    {
+        display->failed = true;
+    }
+    display->busy = false;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "daisy_seed.h"
+#include "dev/oled_ssd130x.h"
+#include "hid/disp/display.h"
+
+namespace daisy
+{
+/**
+ * The SSD1309 OLED of the Dubby (128x64, 4 wire SPI). Drawn into like OledDisplay<SSD130x4WireSpi128x64Driver>,
+ * but Update() does not stall the main loop:
+ * - DrawPixel() and Fill() only touch the framebuffer and record the rectangle of pages and columns that changed
+ * - Update() copies that rectangle into a second buffer in DMA memory and sends it in the background with
+ *   SpiHandle::DmaTransmit, so drawing can go on right away
+ * - while a transfer is running, Update() does nothing, the changes stay dirty and are sent by the next Update()
+ * There is only one DMA buffer, so there must only be one DubbyDisplay.
+ */
+class DubbyDisplay : public OneBitGraphicsDisplayImpl<DubbyDisplay>
+{
+  public:
+    static const int WIDTH = 128;
+    static const int HEIGHT = 64;
+    static const int PAGES = HEIGHT / 8;
+    // Column and page address commands in front of the pixels of every transfer
+    static const int COMMAND_SIZE = 6;
+
+    struct Config
+    {
+        SSD130x4WireSpiTransport::Config transport_config;
+    };
+
+    DubbyDisplay() {}
+    virtual ~DubbyDisplay() {}
+
+    void Init(Config config);
+
+    uint16_t Height() const override { return HEIGHT; }
+    uint16_t Width() const override { return WIDTH; }
+
+    void Fill(bool on) override;
+
+    void DrawPixel(uint_fast8_t x, uint_fast8_t y, bool on) override;
+
+    // Starts sending what changed since the last transfer and returns without waiting for it
+    void Update() override;
+
+    // Sends everything and waits until it is on the display, e.g. before a reset
+    void Flush();
+
+    bool IsBusy() const { return busy; }
+
+    // Bytes sent by the last transfer, without the commands. At most WIDTH * PAGES
+    size_t GetLastTransferSize() const { return txSize; }
+
+  private:
+    void MarkDirty(int page, int column)
+    {
+        if (page < dirtyPageMin) dirtyPageMin = page;
+        if (page > dirtyPageMax) dirtyPageMax = page;
+        if (column < dirtyColumnMin) dirtyColumnMin = column;
+        if (column > dirtyColumnMax) dirtyColumnMax = column;
+    }
+    void MarkAllDirty()
+    {
+        MarkDirty(0, 0);
+        MarkDirty(PAGES - 1, WIDTH - 1);
+    }
+    void SendCommand(uint8_t cmd);
+
+    // SPI callbacks, run in the DMA interrupt. The D/C pin tells commands and pixels apart
+    static void StartCommands(void *context);
+    static void EndCommands(void *context, SpiHandle::Result result);
+    static void StartData(void *context);
+    static void EndData(void *context, SpiHandle::Result result);
+
+    SpiHandle spi;
+    dsy_gpio pinReset;
+    dsy_gpio pinDc;
+
+    uint8_t buffer[WIDTH * PAGES];
+    int dirtyPageMin = PAGES, dirtyPageMax = -1;
+    int dirtyColumnMin = WIDTH, dirtyColumnMax = -1;
+
+    size_t txSize = 0;
+    volatile bool busy = false;
+    // A transfer failed, the next Update() sends the whole framebuffer
+    volatile bool failed = false;
+};
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace daisy
+{
+/**
+ * Hands the latest value of T from one writer to one reader without locks. The writer fills the back buffer and
+ * swaps it with the middle one, the reader swaps the middle one with its front buffer if it was published since.
+ * Neither side waits, the reader always sees a whole value and skips the ones it was too slow for.
+ */
+template <typename T>
+class TripleBuffer
+{
+  public:
+    // Only touched by the writer until Publish()
+    T &GetBack() { return buffers[back]; }
+
+    void Publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+    // Makes the latest published value the front one, false if nothing was published since the last call
+    bool Fetch()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T &GetFront() const { return buffers[front]; }
+
+  private:
+    static const uint8_t INDEX = 3;
+    static const uint8_t FRESH = 4;
+
+    T buffers[3] = {};
+    uint8_t back = 0;
+    uint8_t front = 1;
+    std::atomic<uint8_t> middle{2};
+};
+
+/**
+ * Levels of the physical outputs and a scope of any output of the patch, written by the audio callback and
+ * read by the main loop (the mixer and scope panes of the Dubby).
+ * The callback only does what can not be deferred: peak and sum of squares of its block, and copying every
+ * scope decimation-th sample into a ring. Everything else (RMS, peak hold, triggering) happens in the main loop.
+ * - meters: accumulated over METER_WINDOW samples, then handed over whole through a TripleBuffer
+ * - scope: single producer, single consumer ring of SCOPE_RING_SIZE samples. The reader copies the newest ones and
+ *   checks afterwards that the writer did not overwrite them meanwhile
+ */
+class Metering
+{
+  public:
+    static const int NUM_METERS = 4;
+    // Samples per meter value, about one display frame at 48 kHz
+    static const size_t METER_WINDOW = 1024;
+    static const uint32_t PEAK_HOLD_MS = 1000;
+    // Applied to the held peak once per window after PEAK_HOLD_MS
+    static constexpr float PEAK_HOLD_DECAY = 0.9f;
+    // Must be a power of 2
+    static const uint32_t SCOPE_RING_SIZE = 1024;
+    static const int MAX_SCOPE_DECIMATION = 64;
+
+    // Audio callback: the channels of the physical outputs, NUM_METERS of size samples
+    void WriteMeters(const float *const *channels, size_t size)
+    {
+        MeterWindow &window = meterWindows.GetBack();
+        for (int ch = 0; ch < NUM_METERS; ch++)
+        {
+            const float *samples = channels[ch];
+            float peak = window.peak[ch];
+            float sumSquared = 0.f;
+            for (size_t i = 0; i < size; i++)
+            {
+                peak = std::max(peak, std::fabs(samples[i]));
+                sumSquared += samples[i] * samples[i];
+            }
+            window.peak[ch] = peak;
+            window.sumSquared[ch] += sumSquared;
+        }
+        window.samples += size;
+        if (window.samples >= METER_WINDOW)
+        {
+            meterWindows.Publish();
+            meterWindows.GetBack() = MeterWindow();
+        }
+    }
+
+    // Audio callback: size samples of the scope source, once all blocks ran
+    void WriteScope(size_t size)
+    {
+        const float *source = scopeSource;
+        if (source == nullptr) return;
+        const size_t decimation = scopeDecimation;
+        uint32_t end = scopeEnd.load(std::memory_order_relaxed);
+        size_t i = scopePhase;
+        for (; i < size; i += decimation)
+        {
+            scopeRing[end++ & (SCOPE_RING_SIZE - 1)] = source[i];
+        }
+        // Keeps the spacing of the samples across callbacks
+        scopePhase = i - size;
+        scopeEnd.store(end, std::memory_order_release);
+    }
+
+    // Output channel the scope shows, nullptr for none. Its samples must be valid at the end of the callback
+    void SetScopeSource(const float *source) { scopeSource = source; }
+
+    // The scope shows every decimation-th sample, so its window is width * decimation samples long
+    void SetScopeDecimation(int decimation) { scopeDecimation = std::min(std::max(decimation, 1), MAX_SCOPE_DECIMATION); }
+
+    int GetScopeDecimation() const { return scopeDecimation; }
+
+    // With the trigger, GetScope() starts at a rising zero crossing, so periodic signals stand still
+    void SetScopeTrigger(bool enabled) { scopeTrigger = enabled; }
+
+    // Main loop: takes over the latest meter window, once per frame is enough
+    void Update(uint32_t now)
+    {
+        if (!meterWindows.Fetch()) return;
+        const MeterWindow &window = meterWindows.GetFront();
+        for (int ch = 0; ch < NUM_METERS; ch++)
+        {
+            peak[ch] = window.peak[ch];
+            rms[ch] = window.samples > 0 ? sqrtf(window.sumSquared[ch] / window.samples) : 0.f;
+            if (peak[ch] >= peakHold[ch])
+            {
+                peakHold[ch] = peak[ch];
+                peakHoldTime[ch] = now;
+            }
+            else if (now - peakHoldTime[ch] > PEAK_HOLD_MS)
+            {
+                peakHold[ch] = std::max(peak[ch], peakHold[ch] * PEAK_HOLD_DECAY);
+            }
+        }
+    }
+
+    float GetPeak(int ch) const { return peak[ch]; }
+    float GetRms(int ch) const { return rms[ch]; }
+    float GetPeakHold(int ch) const { return peakHold[ch]; }
+
+    // Main loop: copies width of the newest scope samples into out. Returns false if there are not enough yet,
+    // or they were overwritten while copying, out is then incomplete
+    bool GetScope(float *out, size_t width)
+    {
+        // The trigger is searched in the older half of the ring, the newer one leaves the writer room to go on
+        const uint32_t searchLength = SCOPE_RING_SIZE / 2;
+        const uint32_t end = scopeEnd.load(std::memory_order_acquire);
+        if (width == 0 || width > searchLength || end < width + 1) return false;
+
+        uint32_t start = end - width;
+        if (scopeTrigger)
+        {
+            const uint32_t oldest = end > searchLength + width ? end - searchLength - width : 1;
+            for (uint32_t s = end - width; s > oldest; s--)
+            {
+                if (ScopeSample(s - 1) <= 0.f && ScopeSample(s) > 0.f)
+                {
+                    start = s;
+                    break;
+                }
+            }
+        }
+        for (size_t i = 0; i < width; i++)
+        {
+            out[i] = ScopeSample(start + i);
+        }
+        return scopeEnd.load(std::memory_order_acquire) - start <= SCOPE_RING_SIZE;
+    }
+
+  private:
+    struct MeterWindow
+    {
+        float peak[NUM_METERS] = {0.f};
+        float sumSquared[NUM_METERS] = {0.f};
+        size_t samples = 0;
+    };
+
+    float ScopeSample(uint32_t index) const { return scopeRing[index & (SCOPE_RING_SIZE - 1)]; }
+
+    // Written by the audio callback
+    TripleBuffer<MeterWindow> meterWindows;
+    float scopeRing[SCOPE_RING_SIZE] = {0.f};
+    std::atomic<uint32_t> scopeEnd{0}; // samples written so far, the ring holds the last SCOPE_RING_SIZE of them
+    size_t scopePhase = 0;
+
+    // Set by the main loop
+    const float *volatile scopeSource = nullptr;
+    volatile int scopeDecimation = 1;
+    bool scopeTrigger = true;
+
+    // Main loop only
+    float peak[NUM_METERS] = {0.f};
+    float rms[NUM_METERS] = {0.f};
+    float peakHold[NUM_METERS] = {0.f};
+    uint32_t peakHoldTime[NUM_METERS] = {0};
+};
+}
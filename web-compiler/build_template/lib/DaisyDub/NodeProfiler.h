@@ -0,0 +1,173 @@
+#pragma once
+#include <cstring>
+#include "daisy_seed.h"
+
+/**
+ * Wraps a call of the generated AudioCallback on a block (handle() or latch()) and adds its cycles to the node
+ * of the profiler of the global Dubby dubby. Without DUBBY_PROFILE (make PROFILE=1) this is only the call.
+ */
+#ifdef DUBBY_PROFILE
+#define PROFILE_NODE(node, call)                                    \
+    do                                                              \
+    {                                                               \
+        const uint32_t profileStart = DWT->CYCCNT;                  \
+        call;                                                       \
+        dubby.profiler.AddCycles(node, DWT->CYCCNT - profileStart); \
+    } while (0)
+#else
+#define PROFILE_NODE(node, call) call
+#endif
+
+#ifdef DUBBY_PROFILE
+namespace daisy
+{
+/**
+ * CPU cycles of every node (block) of the patch and of the whole audio callback, measured with the DWT cycle counter.
+ * Aggregated like CpuLoadMeter: minimum and maximum since the last Reset() and an average smoothed by a one pole
+ * lowpass. The audio callback only adds up the cycles of the nodes, OnBlockEnd() folds them into the statistics.
+ * The main loop reads the statistics word by word, a value may be one callback older than the one next to it.
+ *
+ * SendReport() streams them over USB CDC as one binary record, little endian and without padding:
+ *   ReportHeader, NodeRecord[numNodes]
+ * The nodes are in execution order, see web-compiler/codegen/profile_reader.py.
+ */
+class NodeProfiler
+{
+  public:
+    static const int MAX_NODES = 64;
+
+    struct Stats
+    {
+        uint32_t min;
+        uint32_t max;
+        float avg;
+    };
+
+    struct ReportHeader
+    {
+        char magic[4]; // "DPRF"
+        uint16_t numNodes;
+        uint16_t sequence;
+        uint32_t cyclesPerCallback; // the budget
+        uint32_t callbackMin;
+        uint32_t callbackAvg;
+        uint32_t callbackMax;
+    };
+
+    struct NodeRecord
+    {
+        uint16_t node;
+        uint16_t reserved;
+        uint32_t min;
+        uint32_t avg;
+        uint32_t max;
+    };
+
+    /**
+     * names - ids of the nodes in execution order, kept
+     * smoothingCutoffHz - cutoff of the lowpass of the averages, as for CpuLoadMeter
+     */
+    void Init(const char *const *names, int numNodes, float sampleRate, int blockSize, float smoothingCutoffHz = 1.0f)
+    {
+        nodeNames = names;
+        this->numNodes = numNodes < MAX_NODES ? numNodes : MAX_NODES;
+        cyclesPerCallback = uint32_t(float(System::GetSysClkFreq()) * blockSize / sampleRate);
+        const float blockRate = sampleRate / blockSize;
+        const float cutoff = smoothingCutoffHz * 2.0f * 3.141592653f / blockRate;
+        smoothing = cutoff / (cutoff + 1.0f);
+
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        resetPending = true;
+    }
+
+    // Audio callback: at its beginning
+    void OnBlockStart() { blockStart = DWT->CYCCNT; }
+
+    // Audio callback: see PROFILE_NODE
+    void AddCycles(int node, uint32_t cycles)
+    {
+        if (node < MAX_NODES) current[node] += cycles;
+    }
+
+    // Audio callback: at its end
+    void OnBlockEnd()
+    {
+        const uint32_t cycles = DWT->CYCCNT - blockStart;
+        const bool first = resetPending;
+        resetPending = false;
+        Update(callback, cycles, first);
+        for (int n = 0; n < numNodes; n++)
+        {
+            Update(nodes[n], current[n], first);
+            current[n] = 0;
+        }
+    }
+
+    // Starts new minimums and maximums with the next callback
+    void Reset() { resetPending = true; }
+
+    int GetNumNodes() const { return numNodes; }
+    const char *GetNodeName(int node) const { return nodeNames[node]; }
+    uint32_t GetCyclesPerCallback() const { return cyclesPerCallback; }
+    const Stats &GetCallbackStats() const { return callback; }
+    const Stats &GetNodeStats(int node) const { return nodes[node]; }
+
+    // Share of the callback, 1 is all of it
+    float GetLoad(float cycles) const { return cycles / cyclesPerCallback; }
+
+    // Main loop: sends the statistics as one record, false if the previous one is still being sent
+    bool SendReport(UsbHandle &usb)
+    {
+        static uint8_t report[sizeof(ReportHeader) + MAX_NODES * sizeof(NodeRecord)];
+        ReportHeader header;
+        memcpy(header.magic, "DPRF", 4);
+        header.numNodes = numNodes;
+        header.sequence = sequence;
+        header.cyclesPerCallback = cyclesPerCallback;
+        header.callbackMin = callback.min;
+        header.callbackAvg = uint32_t(callback.avg);
+        header.callbackMax = callback.max;
+        memcpy(report, &header, sizeof(header));
+        for (int n = 0; n < numNodes; n++)
+        {
+            NodeRecord record = {uint16_t(n), 0, nodes[n].min, uint32_t(nodes[n].avg), nodes[n].max};
+            memcpy(report + sizeof(header) + n * sizeof(record), &record, sizeof(record));
+        }
+        if (usb.TransmitInternal(report, sizeof(header) + numNodes * sizeof(NodeRecord)) != UsbHandle::Result::OK) return false;
+        sequence++;
+        return true;
+    }
+
+  private:
+    void Update(Stats &stats, uint32_t cycles, bool first)
+    {
+        if (first)
+        {
+            stats.min = stats.max = cycles;
+            stats.avg = cycles;
+            return;
+        }
+        if (cycles < stats.min) stats.min = cycles;
+        if (cycles > stats.max) stats.max = cycles;
+        stats.avg = smoothing * cycles + (1.0f - smoothing) * stats.avg;
+    }
+
+    const char *const *nodeNames = nullptr;
+    int numNodes = 0;
+    uint32_t cyclesPerCallback = 1;
+    float smoothing = 1.0f;
+    uint16_t sequence = 0;
+
+    // Audio callback only
+    uint32_t blockStart = 0;
+    uint32_t current[MAX_NODES] = {0};
+
+    // Written by the audio callback
+    Stats callback = {0, 0, 0.f};
+    Stats nodes[MAX_NODES] = {};
+    volatile bool resetPending = true;
+};
+}
+#endif
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdio>
+#include "daisy_seed.h"
+
+namespace daisy
+{
+/**
+ * Detects audio callbacks that do not finish in time, with the timer of System::GetTick() as CpuLoadMeter:
+ * - overrun: a callback took longer than the period of a block, the SAI played samples that were not written yet
+ * - missed block: two callbacks started more than 1.5 periods apart, a half transfer interrupt of the SAI DMA
+ *   was not served (e.g. the previous callback ran for more than two periods, or interrupts were blocked)
+ *
+ * With degradation enabled, an overrun, a missed block or a callback close to the period (DEGRADE_LOAD) puts the
+ * patch into a degraded mode the generated AudioCallback checks: non-essential blocks are bypassed and control-rate
+ * blocks only run every other callback. It is left after RECOVER_MS without a callback above RECOVER_LOAD.
+ * The counters are written by the audio callback and read by the main loop, which sends them over USB.
+ */
+class OverrunMonitor
+{
+  public:
+    // Share of the period that degrades the patch before it overruns
+    static constexpr float DEGRADE_LOAD = 0.95f;
+    static constexpr float RECOVER_LOAD = 0.75f;
+    static const uint32_t RECOVER_MS = 2000;
+    static const uint32_t REPORT_MS = 500;
+
+    void Init(float sampleRate, int blockSize, bool degradation)
+    {
+        const float secondsPerBlock = blockSize / sampleRate;
+        periodTicks = uint32_t(System::GetTickFreq() * secondsPerBlock);
+        degradeTicks = uint32_t(periodTicks * DEGRADE_LOAD);
+        recoverTicks = uint32_t(periodTicks * RECOVER_LOAD);
+        recoverBlocks = uint32_t(RECOVER_MS * 0.001f / secondsPerBlock);
+        this->degradation = degradation;
+        lastStart = 0;
+    }
+
+    // Before the audio is (re)started, so the pause does not count as missed blocks
+    void OnAudioStart() { lastStart = 0; }
+
+    // Audio callback: at its beginning
+    void OnBlockStart()
+    {
+        const uint32_t now = System::GetTick();
+        if (lastStart != 0 && now - lastStart > periodTicks + periodTicks / 2)
+        {
+            missedBlocks = missedBlocks + (now - lastStart + periodTicks / 2) / periodTicks - 1;
+            Degrade();
+        }
+        lastStart = now;
+        blockCount++;
+        skippingControlRate = degraded && (blockCount & 1);
+    }
+
+    // Audio callback: at its end
+    void OnBlockEnd()
+    {
+        const uint32_t duration = System::GetTick() - lastStart;
+        if (duration > periodTicks)
+        {
+            overruns = overruns + 1;
+        }
+        if (duration > degradeTicks)
+        {
+            Degrade();
+        }
+        else if (degraded && duration < recoverTicks && ++calmBlocks >= recoverBlocks)
+        {
+            degraded = false;
+        }
+    }
+
+    // Non-essential blocks are bypassed
+    bool IsDegraded() const { return degraded; }
+
+    // Control-rate blocks skip this callback
+    bool IsSkippingControlRate() const { return skippingControlRate; }
+
+    uint32_t GetOverruns() const { return overruns; }
+    uint32_t GetMissedBlocks() const { return missedBlocks; }
+    bool HasDegradation() const { return degradation; }
+
+    // Main loop: sends "XRUN <overruns> <missed blocks> <degraded>" as a line of text over USB CDC when one of
+    // them changed, at most every REPORT_MS
+    void SendReport(UsbHandle &usb, uint32_t now)
+    {
+        static char line[48];
+        const uint32_t currentOverruns = overruns;
+        const uint32_t currentMissed = missedBlocks;
+        const bool currentDegraded = degraded;
+        if (now - lastReport < REPORT_MS) return;
+        if (currentOverruns == reportedOverruns && currentMissed == reportedMissed && currentDegraded == reportedDegraded) return;
+        int length = snprintf(line, sizeof(line), "XRUN %lu %lu %d\r\n", (unsigned long)currentOverruns, (unsigned long)currentMissed, currentDegraded ? 1 : 0);
+        if (usb.TransmitInternal((uint8_t *)line, length) != UsbHandle::Result::OK) return;
+        lastReport = now;
+        reportedOverruns = currentOverruns;
+        reportedMissed = currentMissed;
+        reportedDegraded = currentDegraded;
+    }
+
+  private:
+    void Degrade()
+    {
+        calmBlocks = 0;
+        if (degradation) degraded = true;
+    }
+
+    uint32_t periodTicks = 1;
+    uint32_t degradeTicks = 1;
+    uint32_t recoverTicks = 1;
+    uint32_t recoverBlocks = 0;
+    bool degradation = false;
+
+    // Audio callback only
+    uint32_t lastStart = 0;
+    uint32_t blockCount = 0;
+    uint32_t calmBlocks = 0;
+    bool skippingControlRate = false;
+
+    // Main loop only
+    uint32_t lastReport = 0;
+    uint32_t reportedOverruns = 0;
+    uint32_t reportedMissed = 0;
+    bool reportedDegraded = false;
+
+    // Written by the audio callback
+    volatile uint32_t overruns = 0;
+    volatile uint32_t missedBlocks = 0;
+    volatile bool degraded = false;
+};
+}
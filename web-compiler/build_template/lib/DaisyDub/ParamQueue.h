@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include "DspBlock.h"
+
+namespace dspblock
+{
+    // A parameter change for a block, applied with DspBlock::setParameter()
+    struct ParamEvent
+    {
+        DspBlock *block;
+        int param;
+        float value;
+    };
+
+    /**
+     * Lock-free single-producer/single-consumer queue of parameter changes, from the main loop into the audio callback.
+     * Laid out like daisy::RingBuffer, but the read and write positions are atomics, so an event is always stored
+     * before the position that publishes it (RingBuffer only makes them volatile, which does not order the event itself).
+     * Nothing blocks and nothing is allocated. Post() and PostIfChanged() must only be called from one thread
+     * (e.g. the main loop), Drain() only from the audio callback.
+     */
+    class ParamQueue
+    {
+    public:
+        static const size_t CAPACITY = 64; // power of 2, one slot stays empty
+
+        ParamQueue() {}
+
+        void Init()
+        {
+            readPos.store(0, std::memory_order_relaxed);
+            writePos.store(0, std::memory_order_relaxed);
+        }
+
+        // Queues a change, returns false if the queue is full
+        bool Post(DspBlock *block, int param, float value)
+        {
+            size_t w = writePos.load(std::memory_order_relaxed);
+            size_t next = (w + 1) & (CAPACITY - 1);
+            if (next == readPos.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            events[w] = {block, param, value};
+            writePos.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Queues a change only if value differs from lastPosted, which is updated once the change is queued.
+        // A change that does not fit is retried with the next call, so the latest value always gets through.
+        bool PostIfChanged(DspBlock *block, int param, float value, float &lastPosted)
+        {
+            if (value == lastPosted || !Post(block, param, value))
+            {
+                return false;
+            }
+            lastPosted = value;
+            return true;
+        }
+
+        // Applies all queued changes, call it at the start of the audio callback
+        void Drain()
+        {
+            size_t r = readPos.load(std::memory_order_relaxed);
+            size_t w = writePos.load(std::memory_order_acquire);
+            while (r != w)
+            {
+                events[r].block->setParameter(events[r].param, events[r].value);
+                r = (r + 1) & (CAPACITY - 1);
+            }
+            readPos.store(r, std::memory_order_release);
+        }
+
+    private:
+        ParamEvent events[CAPACITY];
+        std::atomic<size_t> readPos{0};
+        std::atomic<size_t> writePos{0};
+    };
+}
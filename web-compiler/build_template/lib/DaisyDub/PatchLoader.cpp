@@ -0,0 +1,377 @@
+#include "PatchLoader.h"
+
+using namespace dspblock;
+using namespace dspblock::patchformat;
+
+// CRC-32 as in zlib, which patch_binary.py uses
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+        uint32_t crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; i++)
+        {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++)
+                {
+                        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+                }
+        }
+        return ~crc;
+}
+
+// Reads the index-th struct of a section, the patch may not be aligned
+template <typename T>
+static T readEntry(const uint8_t *section, int index)
+{
+        T entry;
+        memcpy(&entry, section + index * sizeof(T), sizeof(T));
+        return entry;
+}
+
+PatchLoader::Result PatchLoader::Load(const uint8_t *data, size_t size, Dubby &dubby)
+{
+        Clear();
+        useArenas();
+        Result result = instantiate(data, size, dubby);
+        if (result == Result::OK && hasOverflowed())
+        {
+                result = Result::ERR_MEMORY;
+        }
+        if (result != Result::OK)
+        {
+                Clear();
+        }
+        BlockMemory::SetArenas(nullptr, nullptr);
+        return result;
+}
+
+PatchLoader::Result PatchLoader::instantiate(const uint8_t *data, size_t size, Dubby &dubby)
+{
+        PatchHeader header;
+        if (data == nullptr || size < sizeof(PatchHeader))
+        {
+                return Result::ERR_FORMAT;
+        }
+        memcpy(&header, data, sizeof(PatchHeader));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        {
+                return Result::ERR_FORMAT;
+        }
+        if (header.version != VERSION)
+        {
+                return Result::ERR_VERSION;
+        }
+        size_t expectedSize = sizeof(PatchHeader) + header.numNodes * sizeof(PatchNode) + header.numParams * sizeof(float) + header.numEdges * sizeof(PatchEdge) + header.numBuffers * sizeof(PatchBuffer) + header.numOutputs * sizeof(PatchOutput);
+        if (header.size != size || expectedSize != size)
+        {
+                return Result::ERR_FORMAT;
+        }
+        if (crc32(data + sizeof(PatchHeader), size - sizeof(PatchHeader)) != header.checksum)
+        {
+                return Result::ERR_CHECKSUM;
+        }
+        if (header.numNodes > MAX_NODES)
+        {
+                return Result::ERR_MEMORY;
+        }
+        if (!IsSupported(header.sampleRate, header.blockSize))
+        {
+                return Result::ERR_AUDIO;
+        }
+        sampleRate = header.sampleRate;
+        blockSize = header.blockSize;
+
+        const uint8_t *nodeSection = data + sizeof(PatchHeader);
+        const uint8_t *paramSection = nodeSection + header.numNodes * sizeof(PatchNode);
+        const uint8_t *edgeSection = paramSection + header.numParams * sizeof(float);
+        const uint8_t *bufferSection = edgeSection + header.numEdges * sizeof(PatchEdge);
+        const uint8_t *outputSection = bufferSection + header.numBuffers * sizeof(PatchBuffer);
+
+        // The physical inputs, the buffer pool plus the discard buffer, and silence for the inputs that are not connected
+        audioIn = create<DubbyAudioIns>(blockSize);
+        float *pool = (float *)arena.Allocate((header.poolSize + 1) * blockSize * sizeof(float));
+        float *silence = (float *)arena.Allocate(blockSize * sizeof(float));
+        if (audioIn == nullptr || pool == nullptr || silence == nullptr)
+        {
+                return Result::ERR_MEMORY;
+        }
+        memset(silence, 0, blockSize * sizeof(float));
+        float *discard = pool + header.poolSize * blockSize;
+
+        // Blocks, as the constructor of the ExecutionPlan
+        float params[16];
+        for (int n = 0; n < header.numNodes; n++)
+        {
+                PatchNode node = readEntry<PatchNode>(nodeSection, n);
+                if (node.numParams > 16 || node.firstParam + node.numParams > header.numParams)
+                {
+                        return Result::ERR_BLOCK;
+                }
+                memcpy(params, paramSection + node.firstParam * sizeof(float), node.numParams * sizeof(float));
+                DspBlock *block = createBlock(node.type, params, node.numParams, dubby, blockSize);
+                if (block == nullptr)
+                {
+                        return hasOverflowed() ? Result::ERR_MEMORY : Result::ERR_BLOCK;
+                }
+                nodes[numNodes++] = block;
+                for (int ch = 0; ch < block->getNumInputs(); ch++)
+                {
+                        block->setInputReference(silence, ch);
+                }
+        }
+
+        // Buffer pool and control-rate, as %instanciation%
+        for (int b = 0; b < header.numBuffers; b++)
+        {
+                PatchBuffer buffer = readEntry<PatchBuffer>(bufferSection, b);
+                if (buffer.node >= numNodes || buffer.channel >= nodes[buffer.node]->getNumOutputs() || buffer.slot >= header.poolSize)
+                {
+                        return Result::ERR_GRAPH;
+                }
+                nodes[buffer.node]->setOutputReference(pool + buffer.slot * blockSize, buffer.channel);
+        }
+        for (int n = 0; n < numNodes; n++)
+        {
+                PatchNode node = readEntry<PatchNode>(nodeSection, n);
+                if (node.flags & FLAG_POOLED)
+                {
+                        nodes[n]->setUnusedOutputReferences(discard);
+                }
+                if (node.flags & FLAG_CONTROL_RATE)
+                {
+                        nodes[n]->setControlRate(true);
+                }
+        }
+
+        // %initialization%, the arena may still hold the inputs of the previous patch
+        audioIn->initialize(sampleRate);
+        for (int n = 0; n < numNodes; n++)
+        {
+                nodes[n]->initialize(sampleRate);
+        }
+
+        // %routing%, a block may only read blocks running before it. A BlockDelay reads its input in latch(), after all of them
+        for (int e = 0; e < header.numEdges; e++)
+        {
+                PatchEdge edge = readEntry<PatchEdge>(edgeSection, e);
+                bool feedback = edge.node < numNodes && readEntry<PatchNode>(nodeSection, edge.node).type == TYPE_BLOCK_DELAY;
+                DspBlock *source = edge.source == AUDIO_IN_NODE ? audioIn : ((edge.source < edge.node || feedback) && edge.source < numNodes && edge.node < numNodes ? nodes[edge.source] : nullptr);
+                if (source == nullptr || edge.node >= numNodes || edge.input >= nodes[edge.node]->getNumInputs() || edge.sourceChannel >= source->getNumOutputs())
+                {
+                        return Result::ERR_GRAPH;
+                }
+                nodes[edge.node]->setInputReference(source->getOutputChannel(edge.sourceChannel), edge.input);
+        }
+
+        // %handle_output%
+        for (int o = 0; o < header.numOutputs; o++)
+        {
+                PatchOutput output = readEntry<PatchOutput>(outputSection, o);
+                DspBlock *source = output.source == AUDIO_IN_NODE ? audioIn : (output.source < numNodes ? nodes[output.source] : nullptr);
+                if (output.channel > SCOPE_OUTPUT || source == nullptr || output.sourceChannel >= source->getNumOutputs())
+                {
+                        return Result::ERR_GRAPH;
+                }
+                if (output.channel == SCOPE_OUTPUT)
+                {
+                        scopeSource = source->getOutputChannel(output.sourceChannel);
+                }
+                else
+                {
+                        outputs[output.channel] = source->getOutputChannel(output.sourceChannel);
+                }
+        }
+        // %scope_tap%
+        if (scopeSource == nullptr)
+        {
+                scopeSource = outputs[0];
+        }
+        return Result::OK;
+}
+
+void PatchLoader::Clear()
+{
+        // In reverse order of construction, the arena is reused by the next patch.
+        // With the arenas set, the blocks only give back what did not fit into them
+        useArenas();
+        for (int n = numNodes - 1; n >= 0; n--)
+        {
+                nodes[n]->~DspBlock();
+        }
+        if (audioIn != nullptr)
+        {
+                audioIn->~DubbyAudioIns();
+        }
+        BlockMemory::SetArenas(nullptr, nullptr);
+        audioIn = nullptr;
+        sampleRate = 0;
+        blockSize = 0;
+        numNodes = 0;
+        numDelays = 0;
+        numKnobParams = 0;
+        arena.Reset();
+        largeArena.Reset();
+        for (int ch = 0; ch < NUM_OUTPUTS; ch++)
+        {
+                outputs[ch] = nullptr;
+        }
+        scopeSource = nullptr;
+}
+
+void PatchLoader::WriteInput(const float *data, int channel)
+{
+        if (audioIn != nullptr && channel >= 0 && channel < NUM_INPUTS)
+        {
+                audioIn->writeChannel(data, channel);
+        }
+}
+
+void PatchLoader::Process()
+{
+        for (int n = 0; n < numNodes; n++)
+        {
+                nodes[n]->handle();
+        }
+        for (int d = 0; d < numDelays; d++)
+        {
+                delays[d]->latch();
+        }
+}
+
+float *PatchLoader::GetOutput(int channel)
+{
+        return channel < 0 || channel >= NUM_OUTPUTS ? nullptr : outputs[channel];
+}
+
+void PatchLoader::PostKnobs(ParamQueue &queue, Dubby &dubby)
+{
+        for (int k = 0; k < numKnobParams; k++)
+        {
+                KnobParam &knob = knobParams[k];
+                queue.PostIfChanged(knob.block, knob.param, dubby.GetKnobValue(static_cast<Dubby::Ctrl>(knob.knob)), knob.lastPosted);
+        }
+}
+
+const char *PatchLoader::GetResultString(Result result)
+{
+        switch (result)
+        {
+        case Result::OK:
+                return "OK";
+        case Result::ERR_FORMAT:
+                return "not a patch";
+        case Result::ERR_VERSION:
+                return "unsupported patch version";
+        case Result::ERR_CHECKSUM:
+                return "checksum mismatch";
+        case Result::ERR_BLOCK:
+                return "unknown block or wrong parameters";
+        case Result::ERR_GRAPH:
+                return "invalid routing";
+        case Result::ERR_MEMORY:
+                return "patch too large";
+        case Result::ERR_AUDIO:
+                return "unsupported sample rate or block size";
+        }
+        return "unknown error";
+}
+
+bool PatchLoader::IsSupported(uint32_t sampleRate, size_t blockSize)
+{
+        bool rateSupported = sampleRate == 32000 || sampleRate == 48000 || sampleRate == 96000;
+        bool sizeSupported = blockSize == 32 || blockSize == 64 || blockSize == 128 || blockSize == 256;
+        return rateSupported && sizeSupported;
+}
+
+void PatchLoader::useArenas()
+{
+        BlockMemory::SetArenas(&arena, largeArena.GetSize() > 0 ? &largeArena : nullptr);
+}
+
+void PatchLoader::addKnobParam(DspBlock *block, int param, int knob)
+{
+        if (numKnobParams < MAX_KNOB_PARAMS)
+        {
+                // Starts at 0 like the generated postedParams
+                knobParams[numKnobParams++] = {block, param, knob, 0.f};
+        }
+}
+
+// A count or length among the constructor parameters, rejects fractions, NaN and values an int can not hold
+static bool isCount(float value, int min, int max)
+{
+        return value >= min && value <= max && value == (int)value;
+}
+
+// The counterpart of the constructor calls of genExecutionPlan, params are the numeric constructor parameters.
+// Counts and lengths out of range are rejected like a wrong number of parameters
+DspBlock *PatchLoader::createBlock(uint8_t type, const float *params, int numParams, Dubby &dubby, int bufferLength)
+{
+        DspBlock *block = nullptr;
+        switch (type)
+        {
+        case TYPE_KNOB_MAP:
+                if (numParams == 1 && isCount(params[0], 0, Dubby::CTRL_LAST - 1) && (block = create<KnobMap>(dubby, (int)params[0], bufferLength)))
+                {
+                        addKnobParam(block, 0, (int)params[0]);
+                }
+                return block;
+        case TYPE_DUBBY_KNOBS:
+                if (numParams == 0 && (block = create<DubbyKnobs>(dubby, bufferLength)))
+                {
+                        for (int k = 0; k < 4; k++)
+                        {
+                                addKnobParam(block, k, k);
+                        }
+                }
+                return block;
+        case TYPE_CLOCK:
+                return numParams == 0 ? create<Clock>(bufferLength) : nullptr;
+        case TYPE_OSC:
+                return numParams == 0 ? create<Osc>(bufferLength) : nullptr;
+        case TYPE_ADSR_ENV:
+                return numParams == 0 ? create<ADSREnv>(bufferLength) : nullptr;
+        case TYPE_FEEDBACK_DELAY:
+                return numParams == 1 && isCount(params[0], 1, MAX_DELAY_SAMPLES) ? create<FeedbackDelay>((int)params[0], bufferLength) : nullptr;
+        case TYPE_CONST_VALUE:
+                return numParams == 1 ? create<ConstValue>(params[0], bufferLength) : nullptr;
+        case TYPE_N_MULTIPLIER:
+                return numParams == 1 && isCount(params[0], 1, MAX_BLOCK_CHANNELS) ? create<NMultiplier>((int)params[0], bufferLength) : nullptr;
+        case TYPE_SUM:
+                return numParams == 1 && isCount(params[0], 1, MAX_BLOCK_CHANNELS) ? create<Sum>((int)params[0], bufferLength) : nullptr;
+        case TYPE_SUB:
+                return numParams == 1 && isCount(params[0], 1, MAX_BLOCK_CHANNELS) ? create<Sub>((int)params[0], bufferLength) : nullptr;
+        case TYPE_DIV:
+                return numParams == 1 && isCount(params[0], 1, MAX_BLOCK_CHANNELS) ? create<Div>((int)params[0], bufferLength) : nullptr;
+        case TYPE_SCALER:
+                return numParams == 4 ? create<Scaler>(params[0], params[1], params[2], params[3], bufferLength) : nullptr;
+        case TYPE_UNIPOLARISER:
+                return numParams == 0 ? create<Unipolariser>(bufferLength) : nullptr;
+        case TYPE_VOLUME_CONTROL:
+                return numParams == 0 ? create<VolumeControl>(bufferLength) : nullptr;
+        case TYPE_MIX:
+                return numParams == 2 && isCount(params[0], 1, MAX_BLOCK_CHANNELS) && isCount(params[1], 1, MAX_BLOCK_CHANNELS) ? create<Mix>((int)params[0], (int)params[1], bufferLength) : nullptr;
+        case TYPE_NOISE_GEN:
+                return numParams == 0 ? create<NoiseGen>(bufferLength) : nullptr;
+        case TYPE_MUSICAL_TIME:
+                return numParams == 0 ? create<MusicalTime>(bufferLength) : nullptr;
+        case TYPE_STOF:
+                return numParams == 0 ? create<StoF>(bufferLength) : nullptr;
+        case TYPE_BPF:
+                return numParams == 0 ? create<BPF>(bufferLength) : (numParams == 1 && isCount(params[0], 1, BiquadCascade::MAX_STAGES) ? create<BPF>((int)params[0], bufferLength) : nullptr);
+        case TYPE_LPF:
+                return numParams == 0 ? create<LPF>(bufferLength) : (numParams == 1 && isCount(params[0], 1, BiquadCascade::MAX_STAGES) ? create<LPF>((int)params[0], bufferLength) : nullptr);
+        case TYPE_HPF:
+                return numParams == 0 ? create<HPF>(bufferLength) : (numParams == 1 && isCount(params[0], 1, BiquadCascade::MAX_STAGES) ? create<HPF>((int)params[0], bufferLength) : nullptr);
+        case TYPE_MB_COMPRESSOR:
+                return numParams == 0 ? create<MBCompressor>(bufferLength) : (numParams == 1 && isCount(params[0], 2, MBCompressor::MAX_BANDS) ? create<MBCompressor>((int)params[0], bufferLength) : nullptr);
+        case TYPE_COMPRESSOR:
+                return numParams == 0 ? create<dspblock::Compressor>(bufferLength) : nullptr;
+        case TYPE_BLOCK_DELAY:
+                if (numParams == 0 && (block = create<BlockDelay>(bufferLength)))
+                {
+                        delays[numDelays++] = (BlockDelay *)block;
+                }
+                return block;
+        }
+        return nullptr;
+}
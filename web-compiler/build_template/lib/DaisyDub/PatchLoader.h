@@ -0,0 +1,226 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "BlockMemory.h"
+#include "DspBlock.h"
+#include "ParamQueue.h"
+
+namespace dspblock
+{
+    /**
+     * Binary patch format, written by web-compiler/codegen/patch_binary.py from the same JSON as the code generator.
+     * Everything the code generator decides (execution order, folded constants, control-rate, buffer pool) is already applied.
+     * All fields are little endian, the sections follow each other without padding:
+     *   PatchHeader, PatchNode[numNodes], float[numParams], PatchEdge[numEdges], PatchBuffer[numBuffers], PatchOutput[numOutputs]
+     * Keep the structs and BlockType in sync with patch_binary.py.
+     */
+    namespace patchformat
+    {
+        static const char MAGIC[4] = {'D', 'D', 'P', 'T'};
+        static const uint16_t VERSION = 2;
+        static const uint16_t AUDIO_IN_NODE = 0xFFFF; // source of edges from the physical inputs
+        static const uint16_t SCOPE_OUTPUT = 4;       // channel of the PatchOutput the scope shows, default is output 0
+
+        // Node flags
+        static const uint8_t FLAG_CONTROL_RATE = 1; // setControlRate(true)
+        static const uint8_t FLAG_POOLED = 2;       // outputs are in the buffer pool, unused ones go to the discard buffer
+
+        enum BlockType : uint8_t
+        {
+            TYPE_KNOB_MAP = 1,
+            TYPE_DUBBY_KNOBS,
+            TYPE_CLOCK,
+            TYPE_OSC,
+            TYPE_ADSR_ENV,
+            TYPE_FEEDBACK_DELAY,
+            TYPE_CONST_VALUE,
+            TYPE_N_MULTIPLIER,
+            TYPE_SUM,
+            TYPE_SUB,
+            TYPE_DIV,
+            TYPE_SCALER,
+            TYPE_UNIPOLARISER,
+            TYPE_VOLUME_CONTROL,
+            TYPE_MIX,
+            TYPE_NOISE_GEN,
+            TYPE_MUSICAL_TIME,
+            TYPE_STOF,
+            TYPE_BPF,
+            TYPE_LPF,
+            TYPE_HPF,
+            TYPE_MB_COMPRESSOR,
+            TYPE_COMPRESSOR,
+            TYPE_BLOCK_DELAY,
+        };
+
+        struct PatchHeader
+        {
+            char magic[4];      // MAGIC
+            uint16_t version;   // VERSION
+            uint16_t numNodes;
+            uint16_t numParams;
+            uint16_t numEdges;
+            uint16_t numBuffers;
+            uint16_t numOutputs;
+            uint16_t poolSize;  // buffers in the pool, without the discard buffer
+            uint16_t blockSize; // samples per callback, see PatchLoader::IsSupported()
+            uint32_t sampleRate;
+            uint32_t size;      // of the whole patch, including this header
+            uint32_t checksum;  // CRC-32 (as zlib) of everything after this header
+        };
+
+        // A block, in execution order
+        struct PatchNode
+        {
+            uint8_t type;        // BlockType
+            uint8_t flags;       // FLAG_*
+            uint16_t firstParam; // numeric constructor parameters, without the Dubby reference and the buffer length
+            uint16_t numParams;
+            uint16_t reserved;
+        };
+
+        // setInputReference(), source must run before node, unless node is a BlockDelay
+        struct PatchEdge
+        {
+            uint16_t node;
+            uint16_t input;
+            uint16_t source; // node index or AUDIO_IN_NODE
+            uint16_t sourceChannel;
+        };
+
+        // setOutputReference() to a buffer of the pool
+        struct PatchBuffer
+        {
+            uint16_t node;
+            uint16_t channel;
+            uint16_t slot;
+            uint16_t reserved;
+        };
+
+        // A physical output channel, or the scope tap (SCOPE_OUTPUT)
+        struct PatchOutput
+        {
+            uint16_t channel;
+            uint16_t source; // node index or AUDIO_IN_NODE
+            uint16_t sourceChannel;
+            uint16_t reserved;
+        };
+    }
+
+    /**
+     * Instantiates a binary patch (see patchformat) at runtime, the way the generated ExecutionPlan does at compile time.
+     * The physical inputs, the blocks, everything they allocate (see BlockMemory) and the buffer pool are placed into an
+     * arena inside the loader, which is reset by every Load(). Delay lines go to the large arena if one is set with SetLargeArena().
+     * Every buffer is as long as the block size of the patch, the caller runs the audio with its block size and sample rate.
+     * The loader is large (ARENA_SIZE), so it should be a global. Load() and Clear() must not run while Process() may run,
+     * e.g. stop the audio before.
+     */
+    class PatchLoader
+    {
+    public:
+        enum class Result
+        {
+            OK,
+            ERR_FORMAT,   // not a patch, truncated or inconsistent sizes
+            ERR_VERSION,  // written for another version of the format
+            ERR_CHECKSUM, // corrupted
+            ERR_BLOCK,    // unknown block type or wrong parameters
+            ERR_GRAPH,    // edge, buffer or output out of range
+            ERR_MEMORY,   // does not fit into the arena or MAX_NODES
+            ERR_AUDIO,    // sample rate or block size not supported
+        };
+
+        static const size_t ARENA_SIZE = 96 * 1024;
+        static const int MAX_NODES = 64;
+        static const int MAX_KNOB_PARAMS = 32;
+        // Inputs or outputs of a Mix, NMultiplier, Sum, Sub or Div
+        static const int MAX_BLOCK_CHANNELS = 32;
+        // Keeps the size of a delay line in bytes within an int, the large arena runs out long before
+        static const int MAX_DELAY_SAMPLES = 1 << 24;
+        static const int NUM_OUTPUTS = 4;
+        static const int NUM_INPUTS = 4;
+
+        PatchLoader() { arena.Init(arenaMemory, ARENA_SIZE); }
+        ~PatchLoader() { Clear(); }
+
+        // Memory for the LARGE region of BlockMemory, e.g. in the SDRAM. Without it delay lines are in the arena of the loader
+        void SetLargeArena(void *memory, size_t size) { largeArena.Init(memory, size); }
+
+        // Checks the patch and instantiates it, replacing the current one. On an error the loader stays empty
+        Result Load(const uint8_t *data, size_t size, Dubby &dubby);
+
+        // Destroys the blocks of the current patch
+        void Clear();
+
+        // Copies a block of a physical input channel, before Process()
+        void WriteInput(const float *data, int channel);
+
+        // Runs handle() of every block in execution order, then latch() of the BlockDelays
+        void Process();
+
+        // The output feeding a physical output channel, nullptr if it is not connected
+        float *GetOutput(int channel);
+
+        // The output the scope shows, nullptr if there is none
+        const float *GetScopeSource() { return scopeSource; }
+
+        // Posts the changed knob values of the KnobMap and DubbyKnobs blocks, as the generated %param_posts% do
+        void PostKnobs(ParamQueue &queue, Dubby &dubby);
+
+        int GetNumNodes() { return numNodes; }
+
+        // Of the current patch, 0 while the loader is empty
+        uint32_t GetSampleRate() { return sampleRate; }
+        size_t GetBlockSize() { return blockSize; }
+
+        // The sample rates (32, 48 and 96 kHz) and block sizes (32 - 256 samples, a power of 2) a patch may have
+        static bool IsSupported(uint32_t sampleRate, size_t blockSize);
+
+        size_t GetArenaUsed() { return arena.GetUsed(); }
+
+        size_t GetLargeArenaUsed() { return largeArena.GetUsed(); }
+
+        static const char *GetResultString(Result result);
+
+    private:
+        struct KnobParam
+        {
+            DspBlock *block;
+            int param;
+            int knob;
+            float lastPosted;
+        };
+
+        // Places a block into the arena, nullptr if it does not fit
+        template <typename T, typename... Args>
+        T *create(Args &&...args)
+        {
+            void *memory = arena.Allocate(sizeof(T));
+            return memory == nullptr ? nullptr : new (memory) T(args...);
+        }
+
+        bool hasOverflowed() { return arena.HasOverflowed() || largeArena.HasOverflowed(); }
+
+        Result instantiate(const uint8_t *data, size_t size, Dubby &dubby);
+        // Points BlockMemory to the arenas of the loader while blocks are created or destroyed
+        void useArenas();
+        DspBlock *createBlock(uint8_t type, const float *params, int numParams, Dubby &dubby, int bufferLength);
+        void addKnobParam(DspBlock *block, int param, int knob);
+
+        alignas(8) uint8_t arenaMemory[ARENA_SIZE];
+        MemoryArena arena;
+        MemoryArena largeArena;
+        uint32_t sampleRate = 0;
+        size_t blockSize = 0;
+        DubbyAudioIns *audioIn = nullptr;
+        DspBlock *nodes[MAX_NODES];
+        int numNodes = 0;
+        BlockDelay *delays[MAX_NODES];
+        int numDelays = 0;
+        float *outputs[NUM_OUTPUTS] = {nullptr};
+        const float *scopeSource = nullptr;
+        KnobParam knobParams[MAX_KNOB_PARAMS];
+        int numKnobParams = 0;
+    };
+}
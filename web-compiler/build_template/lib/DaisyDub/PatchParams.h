@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+namespace dspblock
+{
+    /**
+     * The tunable constructor parameters of a patch (e.g. the value of a ConstValue), see TUNABLE_PARAMS in codegen/cpp_parse.py.
+     * The code generator puts the table into its own translation unit (Params.cpp), so changing a value only recompiles that file.
+     * The magic lets the web-compiler find the table in a compiled Main.bin and patch the values without compiling at all.
+     */
+    template <int N>
+    struct PatchParamTable
+    {
+        char magic[8];  // "DDPARAMS"
+        uint32_t count; // N
+        float values[N];
+    };
+}
@@ -0,0 +1,228 @@
+## Requires Python3 !
+"""
+Estimates the CPU load and memory of a patch before it is compiled, so patches that would overrun the audio callback
+or do not fit into the RAM of the Daisy can be rejected (or warned about) without spending compile time on them.
+
+The cycles and sizes of the blocks come from a calibration table, the output of web-compiler/bench (bench_dspblock.cpp).
+On the Seed the table has cycles_per_sample. A table measured on the host only has ns_per_sample, which is converted with
+HOST_CYCLES_PER_NS, a rough guess of how much slower the Cortex-M7 is. Its object_bytes are the sizes on the 64 bit host,
+so the SRAM of the estimate is only an upper bound then. Replace block_costs.tsv with the output of the Seed for real numbers.
+
+Usage: python3 cost_model.py patch.json
+"""
+
+import csv
+import json
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from codegen.cpp_parse import foldConstants, orderBlocks, assignControlRate, allocateBufferPool, getBlockChannels, \
+    getBlockMemory, getNumBands, getReadOuts, getDegradation, applyDegradation, getFootprint, getSampleRate, getBlockSize, \
+    TARGET_MULTI_CHANNEL_BUFFER_SIZE, TARGET_POINTER_SIZE
+
+# Defaults, overridden by the environment variables of the same name
+COST_TABLE = os.environ.get('COST_TABLE', os.path.join(os.path.dirname(os.path.abspath(__file__)), 'block_costs.tsv'))
+HOST_CYCLES_PER_NS = float(os.environ.get('HOST_CYCLES_PER_NS', 4.8))
+COST_WARN_CPU_LOAD = float(os.environ.get('COST_WARN_CPU_LOAD', 0.7))
+COST_MAX_CPU_LOAD = float(os.environ.get('COST_MAX_CPU_LOAD', 0.95))
+COST_MAX_SRAM_BYTES = int(os.environ.get('COST_MAX_SRAM_BYTES', 256 * 1024))
+COST_MAX_SDRAM_BYTES = int(os.environ.get('COST_MAX_SDRAM_BYTES', 64 * 1024 * 1024))
+
+# The Daisy Seed
+CPU_FREQ = 480000000
+# The buffer pool is in the DTCM up to this size, see genBufferPool
+DTCM_POOL_LIMIT = 64 * 1024
+
+"""
+Fits the cycles of handle() calls of different block sizes, as a list of (block size, cycles per call),
+to cycles per call + cycles per sample * block size by least squares. Neither part is negative.
+"""
+def fitCallCost(points):
+    if len(points) == 1:
+        blockSize, cycles = points[0]
+        return 0.0, cycles / blockSize
+    meanSize = sum(x for x, _ in points) / len(points)
+    meanCycles = sum(y for _, y in points) / len(points)
+    perSample = sum((x - meanSize) * (y - meanCycles) for x, y in points) / sum((x - meanSize) ** 2 for x, _ in points)
+    perCall = meanCycles - perSample * meanSize
+    if perSample < 0:
+        return meanCycles, 0.0
+    if perCall < 0:
+        return 0.0, sum(x * y for x, y in points) / sum(x * x for x, _ in points)
+    return perCall, perSample
+
+"""
+Reads a calibration table into {(block, input): (cycles per handle() call, cycles per sample, object bytes, measured on the Seed)}.
+The rows of all block sizes are fitted with fitCallCost, so a call that handles one sample (a control-rate block)
+still pays the fixed part of a call.
+"""
+def loadCostTable(path=COST_TABLE):
+    measurements = {}
+    with open(path, newline='') as f:
+        rows = csv.reader((line for line in f if not line.startswith('#')), delimiter='\t')
+        header = next(rows)
+        for row in rows:
+            entry = dict(zip(header, row))
+            blockSize = int(entry['block_size'])
+            onTarget = entry['cycles_per_sample'] != 'NA'
+            if onTarget:
+                cycles = float(entry['cycles_per_sample'])
+            else:
+                cycles = float(entry['ns_per_sample']) * HOST_CYCLES_PER_NS
+            points, _, _ = measurements.setdefault((entry['block'], entry['input']), ([], int(entry.get('object_bytes', 0) or 0), onTarget))
+            points.append((blockSize, cycles * blockSize))
+    return {key: fitCallCost(points) + (objectBytes, onTarget) for key, (points, objectBytes, onTarget) in measurements.items()}
+
+_costTable = None
+
+def getCostTable():
+    global _costTable
+    if _costTable is None:
+        _costTable = loadCostTable()
+    return _costTable
+
+"""
+Raised for a block of the patch whose type is not in the calibration table, nodeIds names it as RoutingCycleError does
+"""
+class UnknownBlockCostError(Exception):
+    def __init__(self, block):
+        super().__init__(f"Block {block['id']} of type {block['type']} is not in the calibration table")
+        self.nodeIds = [block['id']]
+
+"""
+Looks up a block of the table, for the given kind of input (audio, knob or none). Raises a KeyError if it is not there
+"""
+def lookupCost(table, name, inputKind):
+    for kind in [inputKind, 'audio', 'none']:
+        if (name, kind) in table:
+            return table[(name, kind)]
+    raise KeyError(f"No cost of {name} in the calibration table")
+
+"""
+Returns the cycles per handle() call, the cycles per sample and the object bytes of a block.
+Blocks are benchmarked with their default size, the cost of larger ones is scaled from it.
+"""
+def getBlockCost(table, block, inputKind):
+    # The table has dspblock::Compressor as Compressor
+    blockType = block['type'].split('::')[-1]
+    try:
+        perCall, perSample, objectBytes, _ = lookupCost(table, blockType, inputKind)
+    except KeyError:
+        raise UnknownBlockCostError(block)
+    params = block['constructorParams']
+    scale = 1
+    if blockType in ['NMultiplier', 'Sum', 'Sub', 'Div']:
+        # benchmarked with 2 inputs, one operation per additional input
+        scale = max(int(params[0]) - 1, 1)
+    elif blockType == 'Mix':
+        numIns, numOuts = getBlockChannels(block)
+        scale = numIns * numOuts / 4
+    elif blockType == 'MBCompressor':
+        scale = getNumBands(block) / 3
+    elif blockType == 'BlockDelay':
+        # latch() is not benchmarked, it is one more call that copies as much as handle()
+        scale = 2
+    elif blockType in ['BPF', 'LPF', 'HPF'] and params:
+        # the filters only differ in their coefficients, LPF4 is a cascade of 4 stages
+        stages = lookupCost(table, 'LPF4', inputKind)
+        single = lookupCost(table, 'LPF', inputKind)
+        perCall += max(stages[0] - single[0], 0.0) / 3 * (int(params[0]) - 1)
+        perSample += max(stages[1] - single[1], 0.0) / 3 * (int(params[0]) - 1)
+    return perCall * scale, perSample * scale, objectBytes
+
+"""
+Estimates the cost of a patch, as generated by cpp_parse.py, at its sample rate and block size.
+The blocks are looked up in the rows of the table measured with that block size. Returns a dict with
+- cpuLoad: share of the audio callback the blocks take (1 = the whole callback)
+- cyclesPerCallback: the same in CPU cycles
+- sramBytes, dtcmBytes, sdramBytes: memory of the blocks, the arenas and the buffer pool
+- sramUpperBound: true if sramBytes has the object sizes of the host, which are larger than on the Daisy
+- blocks: the same per block, as a list of {id, type, cpuLoad, bytes}, most expensive first
+- calibration: 'target' if the table was measured on the Seed, otherwise 'host'
+"""
+def estimatePatch(jsonData, table=None):
+    sampleRate = getSampleRate(jsonData)
+    blockSize = getBlockSize(jsonData)
+    table = table if table is not None else getCostTable()
+    readOuts = getReadOuts(jsonData)
+    blocks = foldConstants(jsonData['blocks'], readOuts, sampleRate)
+    orderedBlocks = orderBlocks(list(blocks))
+    controlRateIds = assignControlRate(orderedBlocks, readOuts)
+    applyDegradation(orderedBlocks, controlRateIds, getDegradation(jsonData))
+    poolSize, _ = allocateBufferPool(orderedBlocks, readOuts)
+    controlIds = set(controlRateIds) | {x['id'] for x in orderedBlocks if x['type'] in ['ConstValue', 'KnobMap', 'DubbyKnobs']}
+
+    cyclesPerCallback = CPU_FREQ * blockSize / sampleRate
+    # DubbyAudioIns and the physical outputs, as in genArenas
+    sramBytes = 2 * (getFootprint(TARGET_MULTI_CHANNEL_BUFFER_SIZE) + getFootprint(4 * TARGET_POINTER_SIZE) + getFootprint(4 * blockSize * 4))
+    sdramBytes = 0
+    estimates = []
+    for block in orderedBlocks:
+        sources = [block['inputs'][x]['sourceId'] for x in block['inputs']]
+        if not sources:
+            inputKind = 'none'
+        elif all(x in controlIds for x in sources):
+            inputKind = 'knob'
+        else:
+            inputKind = 'audio'
+        perCall, perSample, objectBytes = getBlockCost(table, block, inputKind)
+        samples = 1 if block['id'] in controlRateIds else blockSize
+        cycles = perCall + perSample * samples
+        blockBytes = objectBytes
+        for region, _, size in getBlockMemory(block, blockSize):
+            if region == 'LARGE':
+                sdramBytes += size
+            else:
+                blockBytes += size
+        sramBytes += blockBytes
+        estimates.append({'id': block['id'], 'type': block['type'], 'cpuLoad': round(cycles / cyclesPerCallback, 5), 'bytes': blockBytes})
+
+    poolBytes = (poolSize + 1) * blockSize * 4
+    dtcmBytes = poolBytes if poolBytes <= DTCM_POOL_LIMIT else 0
+    sramBytes += poolBytes - dtcmBytes
+    cpuLoad = sum(x['cpuLoad'] for x in estimates)
+    onTarget = all(x[3] for x in table.values())
+    return {
+        'cpuLoad': round(cpuLoad, 5),
+        'cyclesPerCallback': round(cpuLoad * cyclesPerCallback),
+        'sramBytes': sramBytes,
+        'dtcmBytes': dtcmBytes,
+        'sdramBytes': sdramBytes,
+        'sramUpperBound': not onTarget,
+        'blocks': sorted(estimates, key=lambda x: -x['cpuLoad']),
+        'calibration': 'target' if onTarget else 'host',
+    }
+
+"""
+Checks an estimate against the budget. Returns (errors, warnings) as lists of messages, a patch with errors is rejected.
+An upper bound of the SRAM over the limit is only a warning.
+"""
+def checkBudget(estimate):
+    errors = []
+    warnings = []
+    load = estimate['cpuLoad']
+    if load > COST_MAX_CPU_LOAD:
+        errors.append(f"The patch needs an estimated {load:.0%} of the audio callback, the limit is {COST_MAX_CPU_LOAD:.0%}")
+    elif load > COST_WARN_CPU_LOAD:
+        warnings.append(f"The patch needs an estimated {load:.0%} of the audio callback, it may glitch")
+    if estimate['sramBytes'] > COST_MAX_SRAM_BYTES and estimate['sramUpperBound']:
+        warnings.append(f"The patch needs up to {estimate['sramBytes'] // 1024} KB of SRAM, the limit is {COST_MAX_SRAM_BYTES // 1024} KB")
+    elif estimate['sramBytes'] > COST_MAX_SRAM_BYTES:
+        errors.append(f"The patch needs an estimated {estimate['sramBytes'] // 1024} KB of SRAM, the limit is {COST_MAX_SRAM_BYTES // 1024} KB")
+    if estimate['sdramBytes'] > COST_MAX_SDRAM_BYTES:
+        errors.append(f"The delay lines of the patch need {estimate['sdramBytes'] // 1024} KB of SDRAM, the limit is {COST_MAX_SDRAM_BYTES // 1024} KB")
+    return errors, warnings
+
+def main():
+    with open(sys.argv[1]) as f:
+        estimate = estimatePatch(json.load(f))
+    print(json.dumps(estimate, indent=4))
+    errors, warnings = checkBudget(estimate)
+    for message in errors + warnings:
+        print(message, file=sys.stderr)
+    return 1 if errors else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,6 +1,9 @@
 import json
 import sys
 import os
+import math
+import re
+import struct
 import traceback
 
 """
@@ -9,35 +12,73 @@ Returns the variable with a prefix
 def getPrefixedVarname(varName: str) -> str:
     return f"block_{varName}"
 
+"""
+Returns the name of the member holding the block inside the ExecutionPlan
+"""
+def getPlanMemberName(varName: str) -> str:
+    return f"node_{varName}"
+
 """ 
-Converts a string x to a DspBlock declaration. The corresponding output is
-DspBlock * x;
+Converts a string x to a declaration of a pointer to its concrete DspBlock class. The corresponding output is
+childClass * x;
+As all DspBlocks are final, calls through this pointer are not dispatched virtually.
 """
-def genBlockDeclaration(varName: str) -> str:
-    return f"DspBlock * {getPrefixedVarname(varName)};"
+def genBlockDeclaration(varName: str, childClass: str) -> str:
+    return f"{childClass} * {getPrefixedVarname(varName)};"
 
 """ 
-Creates an instantiation statement in the form of varName = new childClass(constrParamList..., AUDIO_BLOCK_SIZE);
+Creates the ExecutionPlan struct, which holds every block by value in the order their handle() methods are invoked:
+
+struct ExecutionPlan
+{
+    ExecutionPlan() : node_a(constrParamList..., AUDIO_BLOCK_SIZE), ... {}
+    childClass node_a;
+    ...
+};
+
+orderedBlocks - the blocks as returned by orderBlocks
+controlRateIds - blocks that are marked as control-rate, see getControlRateIds
+paramTable - the tunable parameters as returned by getParamTable, passed as patchParams.values[i]
+"""
+def genExecutionPlan(orderedBlocks, controlRateIds=(), paramTable=None):
+    members = []
+    initializers = []
+    for block in orderedBlocks:
+        member = getPlanMemberName(block['id'])
+        constrParamList = list(block['constructorParams']) + ['AUDIO_BLOCK_SIZE']
+        if paramTable is not None:
+            for index, entry in enumerate(paramTable):
+                if entry[0] == block['id']:
+                    constrParamList[entry[1]] = f"patchParams.values[{index}]"
+        rateComment = ' // control-rate' if block['id'] in controlRateIds else ''
+        members.append(f"    {block['type']} {member};{rateComment}")
+        initializers.append(f"{member}({', '.join(str(p) for p in constrParamList)})")
+
+    lines = ['struct ExecutionPlan', '{']
+    if initializers:
+        lines.append(f"    ExecutionPlan() : {', '.join(initializers)} {{}}")
+    return lines + members + ['};']
+
+""" 
+Creates an instantiation statement, pointing varName to its block inside the ExecutionPlan:
+varName = &plan->node_varName;
 
 varName - pointer the instance should be assigned to
-childClass - the concrete implementation of DspBlock used
-constrParamList - optional and additional constructor parameters
 
 """
-def getInstantiation(varName: str, childClass: str, constrParamList) -> str:
-    constrParamList.append('AUDIO_BLOCK_SIZE')
-    return f"{getPrefixedVarname(varName)} = new {childClass}({', '.join(str(p) for p in constrParamList)});"
+def getInstantiation(varName: str) -> str:
+    return f"{getPrefixedVarname(varName)} = &plan->{getPlanMemberName(varName)};"
 
 """ 
 Optionally creates function-call to the initialize function of a given variable extending from DspBlock in the form of:
-varName->initialize(samplerate);
+varName->initialize(AUDIO_SAMPLE_RATE);
 
 varName - the pointer to a DspBlock instance
 needsInit - returns the statement if true, an empty string otherwise
 
 """
 def genInit(varName: str, needsInit: bool) -> str:
-    return f"{getPrefixedVarname(varName)}->initialize(samplerate);" if needsInit else ""
+    return f"{getPrefixedVarname(varName)}->initialize(AUDIO_SAMPLE_RATE);" if needsInit else ""
 
 """ 
 Returns a list of one function invocation per input. Each statement has the form of:
@@ -66,35 +107,683 @@ Form: varName->handle();
 def genHandleCall(varName: str) -> str:
     return f"{getPrefixedVarname(varName)}->handle();"
 
+"""
+Block types that delay their input by one callback (z^-1). Their handle() does not read the input, it only outputs
+what latch() stored at the end of the previous callback. So they do not wait for their input in orderBlocks,
+which makes them the way to route a signal back to an earlier block.
+"""
+FEEDBACK_TYPES = ['BlockDelay']
+
+"""
+Raised by orderBlocks for a cycle without a FEEDBACK_TYPES block in it.
+nodeIds is the cycle in signal direction, the first id is repeated at the end.
+"""
+class RoutingCycleError(Exception):
+    def __init__(self, nodeIds):
+        self.nodeIds = nodeIds
+        super().__init__(f"Cycle in routing detected: {' -> '.join(nodeIds)}. Insert a BlockDelay to feed a signal back")
+
+""" 
+Returns the blocks in the order their handle() methods have to be invoked, a topological sort in O(blocks + edges).
+Every block comes after the blocks it reads, blocks without inputs and FEEDBACK_TYPES come first. Among blocks
+that are ready at the same time, the order of the provided list is kept.
+
+The provided list is not modified. If the blocks contain a cycle, a RoutingCycleError with its path is raised.
+"""
+def orderBlocks(blocks):
+    blockIds = {x['id'] for x in blocks}
+    # readers of every block, once per edge, and the amount of edges every block still waits for
+    readers = {x['id']: [] for x in blocks}
+    waitingFor = {}
+    for block in blocks:
+        waitingFor[block['id']] = 0
+        if block['type'] in FEEDBACK_TYPES:
+            continue
+        for inCh in block['inputs']:
+            sourceId = block['inputs'][inCh]['sourceId']
+            if sourceId == 'dubbyAudioIn':
+                continue
+            if sourceId not in blockIds:
+                raise Exception(f"Block {block['id']} reads from unknown block {sourceId}")
+            readers[sourceId].append(block)
+            waitingFor[block['id']] += 1
+
+    orderedBlocks = [x for x in blocks if waitingFor[x['id']] == 0]
+    # orderedBlocks doubles as the queue of Kahn's algorithm
+    for block in orderedBlocks:
+        for reader in readers[block['id']]:
+            waitingFor[reader['id']] -= 1
+            if waitingFor[reader['id']] == 0:
+                orderedBlocks.append(reader)
+
+    if len(orderedBlocks) < len(blocks):
+        raise RoutingCycleError(findCycle(blocks, waitingFor))
+    return orderedBlocks
+
+"""
+Returns a cycle among the blocks orderBlocks could not order, as a list of ids in signal direction.
+Every such block still waits for at least one other one, so walking from any of them to a source it waits for
+must end in a cycle.
+"""
+def findCycle(blocks, waitingFor):
+    byId = {x['id']: x for x in blocks}
+    current = next(x['id'] for x in blocks if waitingFor[x['id']] > 0)
+    path = []
+    visited = {}
+    while current not in visited:
+        visited[current] = len(path)
+        path.append(current)
+        inputs = byId[current]['inputs']
+        current = next(inputs[inCh]['sourceId'] for inCh in inputs
+                       if inputs[inCh]['sourceId'] in byId and waitingFor[inputs[inCh]['sourceId']] > 0)
+    cycle = path[visited[current]:]
+    cycle.reverse()
+    return cycle + [cycle[0]]
+
+"""
+Wraps a call on the block at position node of the execution order into PROFILE_NODE, which times it
+if the firmware is built with the profiler (see lib/DaisyDub/NodeProfiler.h):
+PROFILE_NODE(node, call);
+"""
+def genProfiledCall(node: int, call: str) -> str:
+    return f"PROFILE_NODE({node}, {call.rstrip(';')});" if call else ""
+
+"""
+Returns the id of a block as an entry of the node names of the profiler:
+"id",
+"""
+def genNodeName(block) -> str:
+    return f'"{block["id"]}",'
+
+""" 
+Returns a method invocation of latch() for blocks of FEEDBACK_TYPES, an empty string for all others.
+Form: varName->latch();
+"""
+def genLatchCall(block) -> str:
+    return f"{getPrefixedVarname(block['id'])}->latch();" if block['type'] in FEEDBACK_TYPES else ""
+
+"""
+Policies of the "degradation" list of a patch, applied while its callbacks overrun (see OverrunMonitor.h):
+- bypass: blocks with "essential": false run DspBlock::bypass() instead of handle()
+- controlRate: control-rate blocks only run every other callback
+"""
+DEGRADATION_POLICIES = ['bypass', 'controlRate']
+
+"""
+Block types that pass an audio input through while bypassed, see DspBlock::getBypassInput().
+Only they can be marked "essential": false, any other block would output a control input or silence instead.
+"""
+BYPASS_TYPES = ['FeedbackDelay', 'BPF', 'LPF', 'HPF', 'MBCompressor', 'dspblock::Compressor']
+
+"""
+Returns the degradation policies of a patch, raises an exception for an unknown one
+"""
+def getDegradation(jsonData):
+    policies = jsonData.get('degradation') or []
+    for policy in policies:
+        if policy not in DEGRADATION_POLICIES:
+            raise Exception(f"Unknown degradation policy {policy}, use one of {', '.join(DEGRADATION_POLICIES)}")
+    return policies
+
+"""
+Prepares the blocks for the degradation policies: control-rate blocks that may skip a callback keep their own
+output buffers, a buffer of the pool would be overwritten by other blocks meanwhile. Modifies orderedBlocks.
+Raises an exception for a block marked "essential": false that is not of BYPASS_TYPES.
+"""
+def applyDegradation(orderedBlocks, controlRateIds, degradation):
+    for block in orderedBlocks:
+        if block.get('essential', True) is False and block['type'] not in BYPASS_TYPES:
+            raise Exception(f"Block {block['id']} can not be bypassed, only {', '.join(BYPASS_TYPES)} can be non-essential")
+    if 'controlRate' not in degradation:
+        return
+    for block in orderedBlocks:
+        if block['id'] in controlRateIds:
+            block['ownOutputs'] = True
+
+"""
+Guards the handle() call of a block by the degradation policies of the patch, in the form of:
+if (dubby.overruns.IsDegraded()) varName->bypass(); else call
+"""
+def genDegradableCall(block, call, controlRateIds, degradation) -> str:
+    if 'controlRate' in degradation and block['id'] in controlRateIds and block['type'] not in STATIC_OUTPUT_TYPES:
+        return f"if (!dubby.overruns.IsSkippingControlRate()) {call}"
+    if 'bypass' in degradation and block.get('essential', True) is False:
+        return f"if (dubby.overruns.IsDegraded()) {getPrefixedVarname(block['id'])}->bypass(); else {call}"
+    return call
+
+"""
+Sample rates a patch can run at, with the setting of the SAI (SaiHandle::Config::SampleRate) for each,
+and the supported samples per callback. Chosen per patch by "sampleRate" and "blockSize" in the JSON.
+"""
+SAMPLE_RATES = {32000: 'SAI_32KHZ', 48000: 'SAI_48KHZ', 96000: 'SAI_96KHZ'}
+BLOCK_SIZES = [32, 64, 128, 256]
+DEFAULT_SAMPLE_RATE = 48000
+DEFAULT_BLOCK_SIZE = 128
+
+"""
+Returns the sample rate of a patch in Hz, raises an exception for an unsupported one
+"""
+def getSampleRate(jsonData) -> int:
+    sampleRate = int(float(jsonData.get('sampleRate') or DEFAULT_SAMPLE_RATE))
+    if sampleRate not in SAMPLE_RATES:
+        raise Exception(f"Unsupported sample rate {sampleRate}, use one of {', '.join(str(x) for x in SAMPLE_RATES)}")
+    return sampleRate
+
+"""
+Returns the samples per callback of a patch, raises an exception for an unsupported block size
+"""
+def getBlockSize(jsonData) -> int:
+    blockSize = int(float(jsonData.get('blockSize') or DEFAULT_BLOCK_SIZE))
+    if blockSize not in BLOCK_SIZES:
+        raise Exception(f"Unsupported block size {blockSize}, use one of {', '.join(str(x) for x in BLOCK_SIZES)}")
+    return blockSize
+
+""" 
+Returns an entry of the host renderer's profiling table for a given block in the form of:
+{ "id", "type", varName },
+"""
+def genProfileEntry(block) -> str:
+    return f'{{ "{block["id"]}", "{block["type"]}", {getPrefixedVarname(block["id"])} }},'
+
+""" 
+Rounds a Python float to single precision, as the DspBlocks compute in float
+"""
+def toFloat32(value: float) -> float:
+    return struct.unpack('f', struct.pack('f', value))[0]
+
+""" 
+Evaluates a block of FOLDABLE_TYPES for constant inputs, with the same arithmetic as its handle() method.
+
+block - the block to evaluate
+inputValues - the value of every input channel, in channel order
+sampleRate - of the patch, for the blocks converting between time and samples
+
+Returns the value of its (only) output channel.
+"""
+def evaluateBlock(block, inputValues, sampleRate=DEFAULT_SAMPLE_RATE):
+    blockType = block['type']
+    params = [float(p) for p in block['constructorParams']]
+    f = toFloat32
+    if blockType == 'NMultiplier':
+        result = 1.0
+        for x in inputValues:
+            result = f(result * x)
+        return result
+    if blockType == 'Sum':
+        result = 0.0
+        for x in inputValues:
+            result = f(result + x)
+        return result
+    if blockType == 'Sub':
+        result = inputValues[0]
+        for x in inputValues[1:]:
+            result = f(result - x)
+        return result
+    if blockType == 'Div':
+        result = inputValues[0]
+        for x in inputValues[1:]:
+            result = f(result / x)
+        return result
+    if blockType == 'Scaler':
+        inMin, inMax, outMin, outMax = [f(p) for p in params]
+        gain = f(f(outMax - outMin) / f(inMax - inMin))
+        return f(f(inputValues[0] * gain) + f(outMin - f(inMin * gain)))
+    if blockType == 'Unipolariser':
+        return abs(inputValues[0])
+    if blockType == 'VolumeControl':
+        return f(inputValues[1] * inputValues[0])
+    if blockType == 'MusicalTime':
+        bpm, noteValue, dot = inputValues
+        if dot == 1:
+            dot = f(0.5 * noteValue)
+        return f(round(f(f(f(60 / bpm) * sampleRate) * f(noteValue + dot))))
+    if blockType == 'StoF':
+        return f(f(sampleRate / inputValues[0]) / 2)
+    raise Exception(f"{blockType} can not be folded")
+
+""" 
+Returns the amount of input channels of a block of FOLDABLE_TYPES
+"""
+def getNumInputs(block) -> int:
+    if block['type'] in ['NMultiplier', 'Sum', 'Sub', 'Div']:
+        return int(block['constructorParams'][0])
+    return {'Scaler': 1, 'Unipolariser': 1, 'VolumeControl': 2, 'MusicalTime': 3, 'StoF': 1}[block['type']]
+
+""" 
+Block types that are a pure function of their inputs, have a single output and no state.
+Their output is constant if all of their inputs are constant.
+"""
+FOLDABLE_TYPES = ['NMultiplier', 'Sum', 'Sub', 'Div', 'Scaler', 'Unipolariser', 'VolumeControl', 'MusicalTime', 'StoF']
+
+""" 
+Block types whose outputs only change once per callback
+"""
+CONTROL_SOURCE_TYPES = ['ConstValue', 'KnobMap', 'DubbyKnobs']
+
+""" 
+Control-rate input ports per block type: handle() only reads their first sample
+"""
+CONTROL_INPUTS = {
+    'Clock': ['0'],
+    'Osc': ['0'],
+    'ADSREnv': ['1', '2', '3', '4'],
+    'dspblock::Compressor': ['1', '2', '3', '4'],
+    'BPF': ['1', '2'],
+    'LPF': ['1', '2'],
+    'HPF': ['1', '2'],
+    'MBCompressor': ['1', '2', '3', '4', '5', '6', '7'],
+}
+
+"""
+Returns the output channel the scope of the Dubby shows, as a physicalOut entry {"sourceId", "sourceChannel"}:
+the "scope" of the patch (any output of any block) or else the source of physical output 0. None without either.
+"""
+def getScopeTap(jsonData):
+    return jsonData.get('scope') or (jsonData['physicalOut'] or {}).get('0')
+
+"""
+Returns the channels read after all blocks ran, in the form of the physicalOut map: the physical outputs and the
+scope tap (as 'scope'). These are what foldConstants, assignControlRate and allocateBufferPool get as physicalOuts.
+"""
+def getReadOuts(jsonData):
+    readOuts = dict(jsonData['physicalOut'] or {})
+    scopeTap = getScopeTap(jsonData)
+    if scopeTap is not None:
+        readOuts['scope'] = scopeTap
+    return readOuts
+
+""" 
+Constant propagation. Every block of FOLDABLE_TYPES whose inputs all come from ConstValue blocks is evaluated
+here and replaced by a ConstValue with the same id, until no more blocks can be folded. ConstValue blocks that
+are not read anymore afterwards are removed.
+Blocks whose result is not finite (e.g. division by 0) are kept, so the firmware behaves as before.
+
+blocks - the blocks of the patch, they are not modified
+physicalOuts - the physicalOut map of the patch, blocks routed to it are never removed
+sampleRate - of the patch, see getSampleRate
+
+Returns the new list of blocks.
+"""
+def foldConstants(blocks, physicalOuts, sampleRate=DEFAULT_SAMPLE_RATE):
+    blocks = [dict(x) for x in blocks]
+    constants = {x['id']: float(x['constructorParams'][0]) for x in blocks if x['type'] == 'ConstValue'}
+
+    folded = True
+    while folded:
+        folded = False
+        for i, block in enumerate(blocks):
+            if block['type'] not in FOLDABLE_TYPES or not block['inputs']:
+                continue
+            sourceIds = [block['inputs'][inCh]['sourceId'] for inCh in sorted(block['inputs'], key=int)]
+            if any(sourceId not in constants for sourceId in sourceIds):
+                continue
+            # blocks with unconnected inputs are left to fail as before
+            if len(sourceIds) != getNumInputs(block):
+                continue
+            try:
+                value = evaluateBlock(block, [toFloat32(constants[x]) for x in sourceIds], sampleRate)
+            except ZeroDivisionError:
+                continue
+            if not math.isfinite(value):
+                continue
+            blocks[i] = {'type': 'ConstValue', 'id': block['id'], 'constructorParams': [repr(value)], 'inputs': {}}
+            constants[block['id']] = value
+            folded = True
+
+    usedIds = [x['inputs'][inCh]['sourceId'] for x in blocks for inCh in x['inputs']]
+    usedIds += [physicalOuts[outCh]['sourceId'] for outCh in (physicalOuts or {})]
+    return [x for x in blocks if x['type'] != 'ConstValue' or x['id'] in usedIds]
+
+""" 
+Returns the ids of the blocks whose outputs only change once per callback: the blocks of CONTROL_SOURCE_TYPES
+and the blocks of FOLDABLE_TYPES that are only fed by such blocks. These are the candidates for assignControlRate.
+
+orderedBlocks - the blocks as returned by orderBlocks
+"""
+def getControlRateIds(orderedBlocks):
+    controlRateIds = []
+    for block in orderedBlocks:
+        if block['type'] in CONTROL_SOURCE_TYPES:
+            controlRateIds.append(block['id'])
+        elif block['type'] in FOLDABLE_TYPES and block['inputs'] and \
+                all(block['inputs'][inCh]['sourceId'] in controlRateIds for inCh in block['inputs']):
+            controlRateIds.append(block['id'])
+    return controlRateIds
+
+""" 
+Decides which blocks run at control-rate, i.e. only compute the first sample of their outputs.
+
+Starts from the candidates of getControlRateIds and drops every candidate that is read by an audio-rate port
+(any port not in CONTROL_INPUTS of an audio-rate block, or a physical output), until no candidate is dropped anymore.
+A block can be forced to audio-rate with "rate": "audio" in the JSON. "rate": "control" is checked and raises
+an exception if the block can not run at control-rate.
+
+orderedBlocks - the blocks as returned by orderBlocks
+physicalOuts - the physicalOut map of the patch
+
+Returns the ids of the control-rate blocks.
+"""
+def assignControlRate(orderedBlocks, physicalOuts):
+    forcedAudioIds = [x['id'] for x in orderedBlocks if x.get('rate') == 'audio']
+    controlRateIds = [x for x in getControlRateIds(orderedBlocks) if x not in forcedAudioIds]
+    audioReadIds = [physicalOuts[outCh]['sourceId'] for outCh in (physicalOuts or {})]
+
+    changed = True
+    while changed:
+        changed = False
+        # a control-rate block needs all of its inputs at control-rate, see getControlRateIds
+        for block in orderedBlocks:
+            if block['id'] in controlRateIds and block['type'] not in CONTROL_SOURCE_TYPES and \
+                    any(block['inputs'][inCh]['sourceId'] not in controlRateIds for inCh in block['inputs']):
+                controlRateIds.remove(block['id'])
+                changed = True
+        # and must not be read sample by sample
+        for block in orderedBlocks:
+            for inCh in block['inputs']:
+                sourceId = block['inputs'][inCh]['sourceId']
+                if sourceId not in controlRateIds or block['id'] in controlRateIds:
+                    continue
+                if inCh not in CONTROL_INPUTS.get(block['type'], []):
+                    controlRateIds.remove(sourceId)
+                    changed = True
+        for sourceId in audioReadIds:
+            if sourceId in controlRateIds:
+                controlRateIds.remove(sourceId)
+                changed = True
+
+    for block in orderedBlocks:
+        if block.get('rate') == 'control' and block['id'] not in controlRateIds:
+            raise Exception(f"Block {block['id']} can not run at control-rate")
+    return controlRateIds
+
+""" 
+Returns a method invocation switching a block to control-rate, if it is one of controlRateIds:
+varName->setControlRate(true);
+"""
+def genControlRate(varName: str, controlRateIds) -> str:
+    return f"{getPrefixedVarname(varName)}->setControlRate(true);" if varName in controlRateIds else ""
+
+""" 
+Block types whose outputs are only written once in initialize() and therefore can not share a buffer
+"""
+STATIC_OUTPUT_TYPES = ['ConstValue']
+
+"""
+Whether the outputs of a block keep their own buffer instead of sharing the buffer pool: the STATIC_OUTPUT_TYPES,
+and blocks marked "ownOutputs" by applyDegradation, whose handle() is skipped in some callbacks
+"""
+def hasOwnOutputs(block) -> bool:
+    return block['type'] in STATIC_OUTPUT_TYPES or block.get('ownOutputs', False)
+
 """ 
-Return a list of handle() method invocations for all DspBlocks.
-The invocations are ordered so that DspBlocks without any input channels are the first elements, 
-subsequent are invocations of DspBlock that only rely on the first elements, then Blocks relying only on the first or the second elements, and so on.
-
-The provided blocks may not contain cycles. If it does, this method will never halt!
-"""
-def genOrderedHandleCalls(blocks):
-    handledBlocks = [x for x in blocks if not x['inputs']]
-    for block in handledBlocks:
-        blocks.remove(block)
-    while len(blocks) > 0:
-        handledIds = [x['id'] for x in handledBlocks]
-        handledIds.append('dubbyAudioIn')
-        errorState = True
-        for block in blocks:
-            ins = block['inputs']
-            unhandledIns = []
-            for inCh in ins:
-                if ins[inCh]['sourceId'] not in handledIds:
-                    unhandledIns.append(ins[inCh])
-            if len(unhandledIns) == 0:
-                errorState = False
-                handledBlocks.append(block)
-                blocks.remove(block)
-        if errorState:
-            raise Exception("Cycle in routing detected")
-
-    return [genHandleCall(x['id']) for x in handledBlocks]
+Liveness analysis of the output channels, to share a small pool of buffers between them.
+
+Walks the blocks in execution order. Every output channel that is read by another block (or a physical output)
+gets a buffer of the pool when its block runs. The buffer goes back to the pool once the last block reading it
+has run, so it can be reused by blocks running later. Buffers are only released after the reading block ran,
+so a block never writes into one of its own inputs.
+Outputs of the blocks with hasOwnOutputs and of the physical inputs keep their own buffers.
+
+orderedBlocks - the blocks as returned by orderBlocks
+physicalOuts - the physicalOut map of the patch, those channels are live until the end of the callback,
+               as are the inputs of FEEDBACK_TYPES, which are read by latch()
+
+Returns the amount of buffers needed and a map from (blockId, channel) to the index of its buffer in the pool.
+"""
+def allocateBufferPool(orderedBlocks, physicalOuts):
+    pooledIds = [x['id'] for x in orderedBlocks if not hasOwnOutputs(x)]
+
+    # step of the last block reading every channel
+    lastUse = {}
+    for step, block in enumerate(orderedBlocks):
+        for inCh in block['inputs']:
+            source = (block['inputs'][inCh]['sourceId'], int(block['inputs'][inCh]['sourceChannel']))
+            lastUse[source] = len(orderedBlocks) if block['type'] in FEEDBACK_TYPES else max(step, lastUse.get(source, step))
+    for outCh in (physicalOuts or {}):
+        source = (physicalOuts[outCh]['sourceId'], int(physicalOuts[outCh]['sourceChannel']))
+        lastUse[source] = len(orderedBlocks)
+
+    assignments = {}
+    freeBuffers = []
+    poolSize = 0
+    for step, block in enumerate(orderedBlocks):
+        if block['id'] in pooledIds:
+            outputs = sorted(ch for (sourceId, ch) in lastUse if sourceId == block['id'])
+            for ch in outputs:
+                if freeBuffers:
+                    assignments[(block['id'], ch)] = freeBuffers.pop()
+                else:
+                    assignments[(block['id'], ch)] = poolSize
+                    poolSize += 1
+        # release the buffers this block was the last one to read
+        for source in sorted(set(lastUse)):
+            if lastUse[source] == step and source in assignments:
+                freeBuffers.append(assignments[source])
+
+    return poolSize, assignments
+
+""" 
+Declares the shared buffer pool. One extra buffer takes the outputs that are never read.
+It is placed in the DTCM as long as it is small enough to leave room for the stack there.
+"""
+def genBufferPool(poolSize):
+    return [
+        f"#define BUFFER_POOL_SIZE {poolSize}",
+        "#if (BUFFER_POOL_SIZE + 1) * AUDIO_BLOCK_SIZE * 4 <= 64 * 1024",
+        "static float DTCM_MEM_SECTION bufferPool[BUFFER_POOL_SIZE + 1][AUDIO_BLOCK_SIZE];",
+        "#else",
+        "static float bufferPool[BUFFER_POOL_SIZE + 1][AUDIO_BLOCK_SIZE];",
+        "#endif"
+    ]
+
+"""
+Returns the amount of input and output channels of a block
+"""
+def getBlockChannels(block):
+    # dspblock::Compressor as Compressor, like patch_binary.py
+    blockType = block['type'].split('::')[-1]
+    params = [x for x in block['constructorParams'] if isNumericParam(x)]
+    if blockType in FOLDABLE_TYPES:
+        return getNumInputs(block), 1
+    if blockType == 'Mix':
+        return int(params[0]), int(params[1])
+    if blockType == 'MBCompressor':
+        return getNumBands(block) + 4, 1
+    return {'KnobMap': (0, 1), 'DubbyKnobs': (0, 4), 'Clock': (1, 1), 'Osc': (1, 1), 'ADSREnv': (5, 1), 'FeedbackDelay': (2, 1),
+            'ConstValue': (0, 1), 'NoiseGen': (1, 1), 'BPF': (3, 1), 'LPF': (3, 1), 'HPF': (3, 1), 'Compressor': (5, 1), 'BlockDelay': (1, 1)}[blockType]
+
+"""
+Returns the amount of bands of a MBCompressor, clamped like its constructor does
+"""
+def getNumBands(block) -> int:
+    params = block['constructorParams']
+    return min(max(int(params[0]), 2), 4) if params else 3
+
+"""
+Sizes on the Daisy (32 bit), to estimate the memory of a patch without compiling it, see cost_model.py
+"""
+TARGET_POINTER_SIZE = 4
+TARGET_MULTI_CHANNEL_BUFFER_SIZE = 16
+
+"""
+What an allocation of bytes takes from an arena, as MemoryArena::Footprint
+"""
+def getFootprint(numBytes: int) -> int:
+    return (numBytes + 7) & ~7
+
+"""
+Returns what a block takes from the arenas as a list of (region, C++ expression of the bytes, bytes on the Daisy), see BlockMemory.h.
+Covers the constructor of DspBlock, the own output buffer of blocks with hasOwnOutputs and what the subclasses allocate.
+blockSize is the AUDIO_BLOCK_SIZE of the patch.
+"""
+def getBlockMemory(block, blockSize=DEFAULT_BLOCK_SIZE):
+    numIns, numOuts = getBlockChannels(block)
+    blockBytes = getFootprint(TARGET_MULTI_CHANNEL_BUFFER_SIZE) + getFootprint(numOuts * TARGET_POINTER_SIZE) + getFootprint(numIns * TARGET_POINTER_SIZE)
+    memory = [('FAST', f"DspBlock::memoryFootprint({numIns}, {numOuts})", blockBytes)]
+    if hasOwnOutputs(block):
+        memory.append(('FAST', f"MemoryArena::Footprint({numOuts} * AUDIO_BLOCK_SIZE * sizeof(float))",
+                       getFootprint(numOuts * blockSize * 4)))
+    if block['type'] == 'FeedbackDelay':
+        length = int(float(block['constructorParams'][0]))
+        memory.append(('LARGE', f"MemoryArena::Footprint({length} * sizeof(float))", getFootprint(length * 4)))
+    if block['type'] == 'BlockDelay':
+        memory.append(('FAST', "MemoryArena::Footprint(AUDIO_BLOCK_SIZE * sizeof(float))", getFootprint(blockSize * 4)))
+    if block['type'] == 'MBCompressor':
+        memory.append(('FAST', f"MemoryArena::Footprint({getNumBands(block)} * AUDIO_BLOCK_SIZE * sizeof(float))",
+                       getFootprint(getNumBands(block) * blockSize * 4)))
+    return memory
+
+"""
+Declares the arenas the blocks are placed into (see BlockMemory.h), sized exactly for the patch.
+The FAST arena holds the physical inputs and outputs, the ExecutionPlan and everything its blocks allocate, in
+execution order. It is in the internal SRAM, the buffer pool is in the DTCM. Delay lines go to the LARGE arena,
+which is in the SDRAM, so they can be longer than the internal RAM.
+"""
+def genArenas(orderedBlocks):
+    # DubbyAudioIns and the MultiChannelBuffer of the physical outputs, as created by the template, with their own buffers
+    fast = ["MemoryArena::Footprint(sizeof(DubbyAudioIns)) + DspBlock::memoryFootprint(0, 4)",
+            "MemoryArena::Footprint(sizeof(MultiChannelBuffer)) + MemoryArena::Footprint(4 * sizeof(float *))",
+            "2 * MemoryArena::Footprint(4 * AUDIO_BLOCK_SIZE * sizeof(float))",
+            "MemoryArena::Footprint(sizeof(ExecutionPlan))"]
+    large = ['0']
+    for block in orderedBlocks:
+        for region, size, _ in getBlockMemory(block):
+            (large if region == 'LARGE' else fast).append(size)
+    return [
+        f"#define FAST_ARENA_SIZE ({' + '.join(fast)})",
+        f"#define LARGE_ARENA_SIZE ({' + '.join(large)})",
+        "static uint64_t fastArenaMemory[FAST_ARENA_SIZE / 8 + 1];",
+        "static uint64_t DSY_SDRAM_BSS largeArenaMemory[LARGE_ARENA_SIZE / 8 + 1];",
+        "static MemoryArena fastArena(fastArenaMemory, FAST_ARENA_SIZE);",
+        "static MemoryArena largeArena(largeArenaMemory, LARGE_ARENA_SIZE);"
+    ]
+
+""" 
+Points the outputs of a block to its buffers of the pool, in the form of:
+varName->setOutputReference(bufferPool[n], channel);
+varName->setUnusedOutputReferences(bufferPool[BUFFER_POOL_SIZE]);
+
+Blocks with their own output buffers are skipped.
+"""
+def genOutputAssignment(block, assignments):
+    if hasOwnOutputs(block):
+        return []
+    varName = getPrefixedVarname(block['id'])
+    methodCalls = []
+    for (sourceId, ch) in sorted(assignments):
+        if sourceId == block['id']:
+            methodCalls.append(f"{varName}->setOutputReference(bufferPool[{assignments[(sourceId, ch)]}], {ch});")
+    methodCalls.append(f"{varName}->setUnusedOutputReferences(bufferPool[BUFFER_POOL_SIZE]);")
+    return methodCalls
+
+"""
+Constructor parameters per block type that do not change the generated topology, only the numbers the blocks start with.
+They are read from the patchParams table (see PatchParams.h) instead of being compiled into the ExecutionPlan.
+Parameters that size a block (e.g. the number of inputs) are not tunable.
+"""
+TUNABLE_PARAMS = {
+    'ConstValue': [0],
+    'Scaler': [0, 1, 2, 3],
+}
+
+PARAM_TABLE_MAGIC = b'DDPARAMS'
+
+"""
+Returns whether a constructor parameter is a finite number, which can be stored in the table
+"""
+def isNumericParam(param) -> bool:
+    try:
+        return math.isfinite(float(param))
+    except ValueError:
+        return False
+
+"""
+Returns the tunable parameters of the blocks as a list of (blockId, paramIndex, value), in the order of the table
+"""
+def getParamTable(orderedBlocks):
+    table = []
+    for block in orderedBlocks:
+        for index in TUNABLE_PARAMS.get(block['type'], []):
+            if index < len(block['constructorParams']) and isNumericParam(block['constructorParams'][index]):
+                table.append((block['id'], index, toFloat32(float(block['constructorParams'][index]))))
+    return table
+
+"""
+Creates the definition of the parameter table:
+extern const PatchParamTable<N> patchParams = {{'D', 'D', ...}, N, {values...}};
+"""
+def genParamTable(paramTable):
+    size = max(len(paramTable), 1)
+    magic = ', '.join(f"'{chr(x)}'" for x in PARAM_TABLE_MAGIC)
+    values = ', '.join(f"{x[2]!r}f" for x in paramTable) or '0.0f'
+    return [f"extern const PatchParamTable<{size}> patchParams = {{{{{magic}}}, {len(paramTable)}, {{{values}}}}};"]
+
+"""
+Creates the declaration of the parameter table, for a source that is compiled without its definition
+"""
+def genParamTableDeclaration(paramTable):
+    return [f"extern const PatchParamTable<{max(len(paramTable), 1)}> patchParams;"]
+
+"""
+Writes the parameter table into its own translation unit
+"""
+def genParamSource(paramTable, outPath):
+    lines = [
+        '// Generated by codegen/cpp_parse.py, the tunable parameters of the patch. Only this file changes if only they change',
+        '#include "lib/DaisyDub/PatchParams.h"',
+        '',
+        'using namespace dspblock;',
+        '',
+    ] + genParamTable(paramTable)
+    with open(outPath, 'w+') as writefile:
+        writefile.write('\n'.join(lines) + '\n')
+
+"""
+Returns a copy of a compiled binary with the values of its parameter table replaced.
+Raises an exception if the binary has no table with as many values.
+"""
+def patchParamTable(binary: bytes, values) -> bytes:
+    offset = binary.find(PARAM_TABLE_MAGIC)
+    if offset < 0 or binary.find(PARAM_TABLE_MAGIC, offset + 1) >= 0:
+        raise Exception("No unique parameter table in the binary")
+    countOffset = offset + len(PARAM_TABLE_MAGIC)
+    count = struct.unpack_from('<I', binary, countOffset)[0]
+    if count != len(values):
+        raise Exception(f"The parameter table holds {count} values, not {len(values)}")
+    patched = bytearray(binary)
+    struct.pack_into(f'<{count}f', patched, countOffset + 4, *values)
+    return bytes(patched)
+
+""" 
+Returns the knobs read by a block as a list of (parameter, knob number), empty for blocks without knobs.
+"""
+def getKnobParams(block):
+    if block['type'] == 'KnobMap':
+        return [(0, int(block['constructorParams'][1]))]
+    if block['type'] == 'DubbyKnobs':
+        return [(k, k) for k in range(4)]
+    return []
+
+""" 
+Declares the last knob values posted to the ParamQueue, one per knob parameter of the blocks
+"""
+def genParamDeclarations(blocks):
+    numParams = sum(len(getKnobParams(x)) for x in blocks)
+    return [f"static float postedParams[{max(numParams, 1)}];"]
+
+""" 
+Returns the statements posting the knob values of all blocks to the ParamQueue, in the form of:
+paramQueue.PostIfChanged(varName, param, dubby.GetKnobValue(static_cast<Dubby::Ctrl>(knob)), postedParams[n]);
+
+They run in the main loop after dubby.ProcessAllControls(), the audio callback only drains the queue.
+"""
+def genParamPosts(blocks):
+    posts = []
+    for block in blocks:
+        for param, knob in getKnobParams(block):
+            value = f"dubby.GetKnobValue(static_cast<Dubby::Ctrl>({knob}))"
+            posts.append(f"paramQueue.PostIfChanged({getPrefixedVarname(block['id'])}, {param}, {value}, postedParams[{len(posts)}]);")
+    return posts
 
 def genOutputRouting(physicalOuts):
     if physicalOuts == None:
@@ -110,34 +799,97 @@ def genOutputRouting(physicalOuts):
         sourceChannel = outRouting['sourceChannel']
         outRoutings.append(f'dubbyAudioOuts->writeChannel({getPrefixedVarname(sourceId)}->getOutputChannel({sourceChannel}), {i});')
     return outRoutings
-def genCpp(jsonData, requestId):
-    # file = open('test.json')
 
-    blocks = jsonData['blocks']
+"""
+Points the scope of the Dubby at the given channel, see getScopeTap
+"""
+def genScopeTap(scopeTap):
+    if scopeTap is None:
+        return 'dubby.metering.SetScopeSource(nullptr);'
+    return f"dubby.metering.SetScopeSource({getPrefixedVarname(scopeTap['sourceId'])}->getOutputChannel({scopeTap['sourceChannel']}));"
+
+""" 
+Fills the placeholders of a template with the code generated for the given graph and writes the result to outPath.
+Used for both the firmware (buildspace/main.cpp.template) and the host renderer (host/render.cpp.template).
+With paramsOutPath, the parameter table is written to its own source there, otherwise it is defined in outPath.
+Returns the values of the parameter table, see patchParamTable.
+"""
+def genSource(jsonData, templatePath, outPath, paramsOutPath=None):
     try:
-        blockDeclarations = [genBlockDeclaration(x['id']) for x in blocks]
-        blockInstanciation = [getInstantiation(x['id'], x['type'], x['constructorParams']) for x in blocks]
+        sampleRate = getSampleRate(jsonData)
+        blockSize = getBlockSize(jsonData)
+        readOuts = getReadOuts(jsonData)
+        blocks = foldConstants(jsonData['blocks'], readOuts, sampleRate)
+        orderedBlocks = orderBlocks(list(blocks))
+        controlRateIds = assignControlRate(orderedBlocks, readOuts)
+        degradation = getDegradation(jsonData)
+        applyDegradation(orderedBlocks, controlRateIds, degradation)
+        poolSize, poolAssignments = allocateBufferPool(orderedBlocks, readOuts)
+        paramTable = getParamTable(orderedBlocks)
+        blockDeclarations = genParamTable(paramTable) if paramsOutPath is None else genParamTableDeclaration(paramTable)
+        blockDeclarations += genExecutionPlan(orderedBlocks, controlRateIds, paramTable) + [genBlockDeclaration(x['id'], x['type']) for x in orderedBlocks] + genBufferPool(poolSize) + genArenas(orderedBlocks)
+        blockDeclarations += genParamDeclarations(orderedBlocks)
+        blockInstanciation = [getInstantiation(x['id']) for x in orderedBlocks]
+        outputAssignments = [genOutputAssignment(x, poolAssignments) for x in orderedBlocks]
+        blockInstanciation += [item for sublist in outputAssignments for item in sublist]
+        blockInstanciation += [genControlRate(x['id'], controlRateIds) for x in orderedBlocks]
         blockInitializations =[genInit(x['id'], True) for x in blocks]
         blockRoutings = [genRouting(x['id'], x['inputs']) for x in blocks]
         flatRoutings = [item for sublist in blockRoutings for item in sublist]
-        orderedHandleCalls = genOrderedHandleCalls(blocks)
+        orderedHandleCalls = [genDegradableCall(x, genProfiledCall(i, genHandleCall(x['id'])), controlRateIds, degradation) for i, x in enumerate(orderedBlocks)]
+        latchCalls = [x for x in (genProfiledCall(i, genLatchCall(block)) for i, block in enumerate(orderedBlocks)) if x]
+        nodeNames = [genNodeName(x) for x in orderedBlocks]
+        profileEntries = [genProfileEntry(x) for x in orderedBlocks]
         genOutputRoutings = genOutputRouting(jsonData['physicalOut'])
+        scopeTap = genScopeTap(getScopeTap(jsonData))
+        paramPosts = genParamPosts(orderedBlocks)
     except Exception as e:
         traceback.print_exc()
         raise e
-    current_directory = os.getcwd()
-    final_directory = os.path.join(current_directory, 'buildspace', rf'{str(requestId)}')
-    if not os.path.exists(final_directory):
-        os.makedirs(final_directory)
 
-    with open("buildspace/main.cpp.template", 'r') as templatefile:
+    with open(templatePath, 'r') as templatefile:
         template = templatefile.read()
-    with open(f"{final_directory}/Main.cpp", 'w+') as writefile:
+    with open(outPath, 'w+') as writefile:
         template = template.replace('%declarations%', '\n'.join(blockDeclarations))
         template = template.replace('%handle_invocations%', '\n'.join(orderedHandleCalls))
+        template = template.replace('%latch_invocations%', '\n'.join(latchCalls))
+        template = template.replace('%handle_table%', '\n'.join(profileEntries))
         template = template.replace('%handle_output%', '\n'.join(genOutputRoutings))
         template = template.replace('%instanciation%', '\n'.join(blockInstanciation))
         template = template.replace('%initialization%', '\n'.join(blockInitializations))
         template = template.replace('%routing%', '\n'.join(flatRoutings))
+        template = template.replace('%param_posts%', '\n'.join(paramPosts))
+        template = template.replace('%scope_tap%', scopeTap)
+        template = template.replace('%node_names%', '\n'.join(nodeNames))
+        template = template.replace('%degradation%', 'true' if degradation else 'false')
+        template = template.replace('%sample_rate%', str(sampleRate))
+        template = template.replace('%sai_sample_rate%', SAMPLE_RATES[sampleRate])
+        template = template.replace('%block_size%', str(blockSize))
         writefile.write(template)
-    return True
+    if paramsOutPath is not None:
+        genParamSource(paramTable, paramsOutPath)
+    return [x[2] for x in paramTable]
+
+"""
+Returns which block every line of a generated source refers to, as {lineNumber: blockId}, starting at line 1.
+Used to map compiler diagnostics back to the nodes of the graph.
+"""
+def getSourceLineBlocks(sourcePath, blocks):
+    blockIds = set(x['id'] for x in blocks)
+    pattern = re.compile(rf"\b(?:{getPrefixedVarname('')}|{getPlanMemberName('')})(\w+)")
+    lineBlocks = {}
+    with open(sourcePath, 'r') as sourceFile:
+        for number, line in enumerate(sourceFile, start=1):
+            for match in pattern.finditer(line):
+                if match.group(1) in blockIds:
+                    lineBlocks[number] = match.group(1)
+                    break
+    return lineBlocks
+
+def genCpp(jsonData, requestId):
+    current_directory = os.getcwd()
+    final_directory = os.path.join(current_directory, 'buildspace', rf'{str(requestId)}')
+    if not os.path.exists(final_directory):
+        os.makedirs(final_directory)
+
+    return genSource(jsonData, "buildspace/main.cpp.template", f"{final_directory}/Main.cpp", f"{final_directory}/Params.cpp")
@@ -0,0 +1,151 @@
+## Requires Python3 !
+"""
+Serializes a patch into the binary format of the generic firmware (web-compiler/generic), which instantiates it
+at runtime with the PatchLoader (build_template/lib/DaisyDub/PatchLoader.h) instead of compiling it.
+
+Takes the same JSON as cpp_parse.py::genCpp and applies the same passes (folding, ordering, control-rate, buffer pool),
+so the loaded patch runs exactly like the generated one.
+
+Usage: python3 patch_binary.py patch.json out.ddp [--port /dev/ttyACM0]
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from codegen.cpp_parse import foldConstants, orderBlocks, assignControlRate, allocateBufferPool, getReadOuts, getSampleRate, getBlockSize, \
+    isNumericParam, STATIC_OUTPUT_TYPES
+
+# Keep in sync with patchformat in PatchLoader.h
+PATCH_MAGIC = b'DDPT'
+PATCH_VERSION = 2
+AUDIO_IN_NODE = 0xFFFF
+SCOPE_OUTPUT = 4
+FLAG_CONTROL_RATE = 1
+FLAG_POOLED = 2
+
+BLOCK_TYPE_IDS = {
+    'KnobMap': 1,
+    'DubbyKnobs': 2,
+    'Clock': 3,
+    'Osc': 4,
+    'ADSREnv': 5,
+    'FeedbackDelay': 6,
+    'ConstValue': 7,
+    'NMultiplier': 8,
+    'Sum': 9,
+    'Sub': 10,
+    'Div': 11,
+    'Scaler': 12,
+    'Unipolariser': 13,
+    'VolumeControl': 14,
+    'Mix': 15,
+    'NoiseGen': 16,
+    'MusicalTime': 17,
+    'StoF': 18,
+    'BPF': 19,
+    'LPF': 20,
+    'HPF': 21,
+    'MBCompressor': 22,
+    'Compressor': 23,
+    'BlockDelay': 24,
+}
+
+HEADER_FORMAT = '<4sHHHHHHHHIII'
+NODE_FORMAT = '<BBHHH'
+ENTRY_FORMAT = '<HHHH'
+
+# The Dubby reference of KnobMap and DubbyKnobs is passed by the loader, it is not stored
+DUBBY_PARAM = 'dubby'
+
+"""
+Returns the numeric constructor parameters of a block, raises an exception for any other parameter
+"""
+def getNumericParams(block):
+    params = []
+    for param in block['constructorParams']:
+        if str(param).strip() == DUBBY_PARAM:
+            continue
+        if not isNumericParam(param):
+            raise Exception(f"Parameter {param} of {block['id']} can not be stored in a binary patch")
+        params.append(float(param))
+    return params
+
+"""
+Returns the binary patch of a graph
+"""
+def genPatchBinary(jsonData) -> bytes:
+    sampleRate = getSampleRate(jsonData)
+    readOuts = getReadOuts(jsonData)
+    blocks = foldConstants(jsonData['blocks'], readOuts, sampleRate)
+    orderedBlocks = orderBlocks(list(blocks))
+    controlRateIds = assignControlRate(orderedBlocks, readOuts)
+    poolSize, assignments = allocateBufferPool(orderedBlocks, readOuts)
+
+    index = {block['id']: n for n, block in enumerate(orderedBlocks)}
+    index['dubbyAudioIn'] = AUDIO_IN_NODE
+
+    nodes = b''
+    params = []
+    for block in orderedBlocks:
+        typeName = block['type'].split('::')[-1]
+        if typeName not in BLOCK_TYPE_IDS:
+            raise Exception(f"Block type {block['type']} is not supported by the generic firmware")
+        flags = FLAG_CONTROL_RATE if block['id'] in controlRateIds else 0
+        if block['type'] not in STATIC_OUTPUT_TYPES:
+            flags |= FLAG_POOLED
+        blockParams = getNumericParams(block)
+        nodes += struct.pack(NODE_FORMAT, BLOCK_TYPE_IDS[typeName], flags, len(params), len(blockParams), 0)
+        params += blockParams
+
+    edges = b''
+    numEdges = 0
+    for block in orderedBlocks:
+        for inCh in block['inputs']:
+            source = block['inputs'][inCh]
+            edges += struct.pack(ENTRY_FORMAT, index[block['id']], int(inCh), index[source['sourceId']], int(source['sourceChannel']))
+            numEdges += 1
+
+    buffers = b''
+    for (sourceId, ch) in sorted(assignments, key=lambda x: (index[x[0]], x[1])):
+        buffers += struct.pack(ENTRY_FORMAT, index[sourceId], ch, assignments[(sourceId, ch)], 0)
+
+    # Without a scope tap of its own, the loader shows physical output 0
+    physicalOuts = dict(jsonData['physicalOut'] or {})
+    if jsonData.get('scope'):
+        physicalOuts[str(SCOPE_OUTPUT)] = jsonData['scope']
+    outputs = b''
+    for outCh in physicalOuts:
+        source = physicalOuts[outCh]
+        outputs += struct.pack(ENTRY_FORMAT, int(outCh), index[source['sourceId']], int(source['sourceChannel']), 0)
+
+    body = nodes + struct.pack(f'<{len(params)}f', *params) + edges + buffers + outputs
+    header = struct.pack(HEADER_FORMAT, PATCH_MAGIC, PATCH_VERSION, len(orderedBlocks), len(params), numEdges,
+                         len(assignments), len(physicalOuts), poolSize, getBlockSize(jsonData), sampleRate,
+                         struct.calcsize(HEADER_FORMAT) + len(body), zlib.crc32(body))
+    return header + body
+
+def main():
+    parser = argparse.ArgumentParser(description='Serialize a patch for the generic firmware')
+    parser.add_argument('patch', help='patch JSON, as posted to /compiler')
+    parser.add_argument('out', help='binary patch to write')
+    parser.add_argument('--port', help='also send it to a Dubby running the generic firmware, e.g. /dev/ttyACM0')
+    args = parser.parse_args()
+
+    with open(args.patch) as f:
+        patch = genPatchBinary(json.load(f))
+    with open(args.out, 'wb') as f:
+        f.write(patch)
+    if args.port:
+        # USB CDC, no serial settings needed
+        with open(args.port, 'wb') as port:
+            port.write(patch)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,91 @@
+## Requires Python3 !
+"""
+Reads the reports of a firmware built with the profiler (make PROFILE=1, "profile": true in the patch JSON)
+from its USB serial port and prints the load of the callback and of every node, most expensive first.
+The reports only hold the position of a node in the execution order, its id is looked up in the patch.
+See build_template/lib/DaisyDub/NodeProfiler.h for the format.
+
+Usage: python3 profile_reader.py patch.json /dev/ttyACM0 [-n reports]
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from codegen.cpp_parse import foldConstants, orderBlocks, getReadOuts, getSampleRate
+
+REPORT_MAGIC = b'DPRF'
+HEADER_FORMAT = '<4sHHIIII'
+NODE_FORMAT = '<HHIII'
+
+"""
+Returns the ids of the nodes of a patch in the order of the reports
+"""
+def getNodeIds(jsonData):
+    blocks = foldConstants(jsonData['blocks'], getReadOuts(jsonData), getSampleRate(jsonData))
+    return [x['id'] for x in orderBlocks(list(blocks))]
+
+"""
+Reads reports from a binary stream. Yields dicts with sequence, cyclesPerCallback, callback {min, avg, max}
+and nodes, a list of {node, min, avg, max} in cycles. Bytes before a report are skipped.
+"""
+def readReports(stream):
+    buffer = b''
+    headerSize = struct.calcsize(HEADER_FORMAT)
+    nodeSize = struct.calcsize(NODE_FORMAT)
+    while True:
+        start = buffer.find(REPORT_MAGIC)
+        if start >= 0 and len(buffer) - start >= headerSize:
+            _, numNodes, sequence, cyclesPerCallback, cbMin, cbAvg, cbMax = struct.unpack_from(HEADER_FORMAT, buffer, start)
+            end = start + headerSize + numNodes * nodeSize
+            if len(buffer) >= end:
+                nodes = []
+                for n in range(numNodes):
+                    node, _, nodeMin, nodeAvg, nodeMax = struct.unpack_from(NODE_FORMAT, buffer, start + headerSize + n * nodeSize)
+                    nodes.append({'node': node, 'min': nodeMin, 'avg': nodeAvg, 'max': nodeMax})
+                buffer = buffer[end:]
+                yield {
+                    'sequence': sequence,
+                    'cyclesPerCallback': cyclesPerCallback,
+                    'callback': {'min': cbMin, 'avg': cbAvg, 'max': cbMax},
+                    'nodes': nodes,
+                }
+                continue
+        data = stream.read(1024)
+        if not data:
+            return
+        buffer = (buffer[start:] if start >= 0 else buffer[-len(REPORT_MAGIC):]) + data
+
+def printReport(report, nodeIds):
+    budget = report['cyclesPerCallback']
+    callback = report['callback']
+    print(f"# report {report['sequence']}: callback {callback['avg'] / budget:.1%} avg, {callback['max'] / budget:.1%} max of {budget} cycles")
+    print('id\tmin_load\tavg_load\tmax_load\tmax_cycles')
+    for node in sorted(report['nodes'], key=lambda x: -x['avg']):
+        nodeId = nodeIds[node['node']] if node['node'] < len(nodeIds) else str(node['node'])
+        print(f"{nodeId}\t{node['min'] / budget:.4f}\t{node['avg'] / budget:.4f}\t{node['max'] / budget:.4f}\t{node['max']}")
+    sys.stdout.flush()
+
+def main():
+    parser = argparse.ArgumentParser(description='Print the per-node profile streamed by a Dubby')
+    parser.add_argument('patch', help='patch JSON the firmware was built from')
+    parser.add_argument('port', help='USB serial port of the Dubby, e.g. /dev/ttyACM0, or a file of recorded reports')
+    parser.add_argument('-n', '--reports', type=int, default=0, help='stop after this many reports')
+    args = parser.parse_args()
+
+    with open(args.patch) as f:
+        nodeIds = getNodeIds(json.load(f))
+    # USB CDC, no serial settings needed
+    with open(args.port, 'rb', buffering=0) as port:
+        for count, report in enumerate(readReports(port), start=1):
+            printReport(report, nodeIds)
+            if count == args.reports:
+                break
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
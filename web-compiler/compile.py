@@ -1,11 +1,14 @@
 ## Requires Python3 !
 
 import os
+import re
 import uuid
-import shutil
 import subprocess
    
-def compile(requestId):
+"""
+Builds the Main.cpp generated for requestId. With profile, the per-node profiler is built into the firmware (make PROFILE=1).
+"""
+def compile(requestId, jobs=1, onOutput=None, profile=False):
     # Generate unique id for upload file
     identifier = requestId 
     current_directory = os.getcwd()
@@ -18,16 +21,64 @@ def compile(requestId):
     # Don't overwrite files...
     if not os.path.exists(filename):
         raise Exception(f"Could not compile, because the Main.cpp for {requestId} could not be found")
-    copyBuildFiles(final_directory)
-    buildTarget(final_directory)
+    copyBuildFiles(final_directory, profile)
+    buildTarget(final_directory, jobs, onOutput)
 
-def copyBuildFiles(toDir):
+# Archive of Dubby and the CMSIS-DSP kernels, built once with "make daisydub" in the build_template (see Dockerfile)
+PREBUILT_LIB = os.path.join('lib', 'DaisyDub', 'build', 'libdaisydub.a')
+
+"""
+A workspace only holds the generated Main.cpp, a Makefile and the build outputs. The Makefile includes the
+build_template in place (read-only, all objects are built into the workspace) instead of a copy of it.
+If the template libraries are prebuilt, make compiles nothing but Main.cpp and links it against libdaisy.a,
+libdaisysp.a and libdaisydub.a, otherwise Dubby and the CMSIS-DSP kernels are compiled as well.
+"""
+def copyBuildFiles(toDir, profile=False):
     currentDirectory = os.getcwd()
     fullPath = os.path.join(currentDirectory, r'build_template')
-    files = os.listdir(fullPath)
-    shutil.copytree(fullPath, toDir, dirs_exist_ok=True)
+    writeRequestMakefile(toDir, fullPath, os.path.exists(os.path.join(fullPath, PREBUILT_LIB)), profile)
+
+def writeRequestMakefile(toDir, templatePath, prebuilt, profile=False):
+    with open(os.path.join(toDir, 'Makefile'), 'w') as f:
+        f.write(f'TEMPLATE_DIR = {templatePath}\n')
+        if prebuilt:
+            f.write('PREBUILT = 1\n')
+        if profile:
+            f.write('PROFILE = 1\n')
+        f.write('include $(TEMPLATE_DIR)/Makefile\n')
    
-def buildTarget(dir):
+"""
+Runs make with the given amount of parallel jobs. Every line make and the compiler print is passed to onOutput.
+The output is read until make exits, waiting without reading would block make once the pipe is full.
+Returns the exit code of make.
+"""
+def buildTarget(dir, jobs=1, onOutput=None):
     # subprocess.call(['sh', f'{dir}/build.sh'])
     # subprocess.call(['cd',dir,';','sh', f'./build.sh'])
-    subprocess.Popen(["make"], stdout=subprocess.PIPE, cwd=dir).wait()
\ No newline at end of file
+    process = subprocess.Popen(["make", f"-j{jobs}"], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, cwd=dir, text=True)
+    for line in process.stdout:
+        if onOutput is not None:
+            onOutput(line.rstrip('\n'))
+    return process.wait()
+
+COMPILER_DIAGNOSTIC = re.compile(r'^(?P<file>[^:\s]+):(?P<line>\d+):(?P<column>\d+): (?P<severity>fatal error|error|warning|note): (?P<message>.*)$')
+LINKER_ERRORS = ['undefined reference', 'overflowed', 'multiple definition']
+
+"""
+Returns a line printed by the compiler or linker as
+{'file', 'line', 'column', 'severity', 'message'}, or None if it is not a diagnostic
+"""
+def parseDiagnostic(line):
+    match = COMPILER_DIAGNOSTIC.match(line)
+    if match:
+        diagnostic = match.groupdict()
+        diagnostic['line'] = int(diagnostic['line'])
+        diagnostic['column'] = int(diagnostic['column'])
+        return diagnostic
+    if 'ld' in line and any(x in line for x in LINKER_ERRORS):
+        return {'file': None, 'line': None, 'column': None, 'severity': 'error', 'message': line}
+    return None
+
+# make prints this when it links the firmware, see the core Makefile of libDaisy
+def isLinkCommand(line) -> bool:
+    return '-o build/Main.elf' in line
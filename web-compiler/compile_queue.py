@@ -0,0 +1,154 @@
+## Requires Python3 !
+
+import os
+import time
+import queue
+import threading
+
+# Defaults, overridden by the environment variables of the same name
+COMPILE_WORKERS = int(os.environ.get('COMPILE_WORKERS', max(1, (os.cpu_count() or 1) // 2)))
+MAKE_JOBS = int(os.environ.get('MAKE_JOBS', 2))
+COMPILE_QUEUE_SIZE = int(os.environ.get('COMPILE_QUEUE_SIZE', 32))
+
+# Retry-After for a full queue before the first job has finished
+DEFAULT_JOB_SECONDS = 10
+
+# Finished jobs are kept this long for polling
+JOB_RETENTION_SECONDS = 600
+
+QUEUED = 'queued'
+RUNNING = 'running'
+DONE = 'done'
+FAILED = 'failed'
+
+class QueueFull(Exception):
+    def __init__(self, retryAfter):
+        super().__init__(f"Compile queue is full, retry after {retryAfter}s")
+        self.retryAfter = retryAfter
+
+"""
+A queued compilation. Progress is recorded as a list of events (e.g. phases, make output and diagnostics),
+which can be followed with waitForEvents() while the job runs.
+"""
+class CompileJob:
+    def __init__(self, jobId, task, estimate=None):
+        self.id = jobId
+        self.task = task
+        # CPU and memory of the patch, see codegen/cost_model.py
+        self.estimate = estimate
+        self.status = QUEUED
+        self.result = None
+        self.error = None
+        self.submitted = time.time()
+        self.finished = None
+        self.done = threading.Event()
+        self.events = []
+        self.diagnostics = []
+        self.changed = threading.Condition()
+
+    def addEvent(self, event, data):
+        with self.changed:
+            self.events.append((event, data))
+            if event == 'diagnostic':
+                self.diagnostics.append(data)
+            self.changed.notify_all()
+
+    def finish(self, status, result=None, error=None):
+        with self.changed:
+            self.result = result
+            self.error = error
+            self.status = status
+            self.finished = time.time()
+            self.done.set()
+            self.changed.notify_all()
+
+    # Returns the events after the first start ones, waits up to timeout seconds for one while the job is not finished
+    def waitForEvents(self, start, timeout):
+        with self.changed:
+            if len(self.events) <= start and not self.done.is_set():
+                self.changed.wait(timeout)
+            return self.events[start:]
+
+    def toDict(self):
+        return {'id': str(self.id), 'status': self.status, 'error': self.error, 'diagnostics': self.diagnostics, 'estimate': self.estimate}
+
+"""
+Bounded queue of compile jobs, run by a pool of worker threads.
+Each worker is pinned to its own set of makeJobs cores (where the OS allows it), which the make it starts
+inherits, and runs make with as many parallel jobs. submit() raises QueueFull instead of growing the queue.
+A task is called as task(job, makeJobs), it can report its progress with job.addEvent(). Its return value becomes the result of the job.
+"""
+class CompileQueue:
+    def __init__(self, workers=COMPILE_WORKERS, makeJobs=MAKE_JOBS, queueSize=COMPILE_QUEUE_SIZE):
+        self.workers = workers
+        self.makeJobs = makeJobs
+        self.pending = queue.Queue(maxsize=queueSize)
+        self.jobs = {}
+        self.lock = threading.Lock()
+        self.averageSeconds = DEFAULT_JOB_SECONDS
+        for i in range(workers):
+            threading.Thread(target=self.work, args=(i,), daemon=True).start()
+
+    def submit(self, jobId, task, estimate=None):
+        job = CompileJob(jobId, task, estimate)
+        with self.lock:
+            self.removeFinishedJobs()
+            try:
+                self.pending.put_nowait(job)
+            except queue.Full:
+                raise QueueFull(self.getRetryAfter())
+            self.jobs[str(jobId)] = job
+        return job
+
+    # Registers a job that needs no compiling, e.g. one served from the FirmwareCache
+    def addFinished(self, jobId, result, estimate=None):
+        job = CompileJob(jobId, None, estimate)
+        job.finish(DONE, result)
+        with self.lock:
+            self.removeFinishedJobs()
+            self.jobs[str(jobId)] = job
+        return job
+
+    def getJob(self, jobId):
+        with self.lock:
+            return self.jobs.get(str(jobId))
+
+    # True while the job is queued or running, so its workspace is still needed
+    def isActive(self, jobId) -> bool:
+        job = self.getJob(jobId)
+        return job is not None and not job.done.is_set()
+
+    # Seconds until a slot in the queue is expected to be free
+    def getRetryAfter(self) -> int:
+        return max(1, round(self.averageSeconds * self.pending.qsize() / self.workers))
+
+    def getStats(self):
+        return {'workers': self.workers, 'makeJobs': self.makeJobs, 'queued': self.pending.qsize(), 'queueSize': self.pending.maxsize}
+
+    def work(self, index):
+        self.pinToCores(index)
+        while True:
+            job = self.pending.get()
+            job.status = RUNNING
+            start = time.time()
+            try:
+                job.finish(DONE, job.task(job, self.makeJobs))
+            except Exception as e:
+                job.finish(FAILED, error=str(e))
+            with self.lock:
+                # Exponential moving average, used for Retry-After
+                self.averageSeconds += 0.2 * (job.finished - start - self.averageSeconds)
+
+    # Pins the calling worker thread (and the processes it starts) to its share of the cores
+    def pinToCores(self, index):
+        if not hasattr(os, 'sched_setaffinity'):
+            return
+        cores = sorted(os.sched_getaffinity(0))
+        first = (index * self.makeJobs) % len(cores)
+        share = [cores[(first + i) % len(cores)] for i in range(min(self.makeJobs, len(cores)))]
+        os.sched_setaffinity(0, share)
+
+    def removeFinishedJobs(self):
+        now = time.time()
+        for jobId in [x for x, job in self.jobs.items() if job.finished and now - job.finished > JOB_RETENTION_SECONDS]:
+            del self.jobs[jobId]
@@ -0,0 +1,154 @@
+## Requires Python3 !
+
+import os
+import json
+import hashlib
+import threading
+import subprocess
+from collections import OrderedDict
+from codegen.cpp_parse import orderBlocks, getSampleRate, getBlockSize, DEFAULT_SAMPLE_RATE, DEFAULT_BLOCK_SIZE
+
+# Amount of binaries kept, the least recently used one is evicted first
+CACHE_SIZE = 256
+
+CACHE_DIR = 'firmwarecache'
+
+# Everything besides the graph that ends up in Main.bin. The archives are only there once they are built (see Dockerfile)
+VERSION_FILES = [
+    os.path.join('codegen', 'cpp_parse.py'),
+    os.path.join('buildspace', 'main.cpp.template'),
+    os.path.join('build_template', 'Makefile'),
+    os.path.join('build_template', 'lib', 'libDaisy', 'build', 'libdaisy.a'),
+    os.path.join('build_template', 'lib', 'DaisySP', 'build', 'libdaisysp.a'),
+    os.path.join('build_template', 'lib', 'DaisyDub', 'build', 'libdaisydub.a'),
+]
+VERSION_DIRS = [
+    os.path.join('build_template', 'lib', 'DaisyDub'),
+]
+
+"""
+Returns a constructor parameter in a canonical form, so "0.50" and "0.5" are the same parameter
+"""
+def normalizeParam(param) -> str:
+    try:
+        return repr(float(param))
+    except ValueError:
+        return str(param).strip()
+
+"""
+Returns a copy of the graph that only holds what the generated code depends on.
+Blocks are renamed by their position in the order of orderBlocks, so two graphs that only differ
+in their ids, in the order of their blocks or in the formatting of their parameters are the same.
+"""
+def canonicalizeGraph(jsonData):
+    blocks = sorted(jsonData['blocks'], key=lambda x: (x['type'], [normalizeParam(p) for p in x.get('constructorParams', [])]))
+    orderedBlocks = orderBlocks(list(blocks))
+    names = {block['id']: f'b{i}' for i, block in enumerate(orderedBlocks)}
+    names['dubbyAudioIn'] = 'dubbyAudioIn'
+
+    def canonicalInputs(inputs):
+        return {str(ch): [names[inputs[ch]['sourceId']], int(inputs[ch]['sourceChannel'])] for ch in inputs}
+
+    canonicalBlocks = []
+    for block in orderedBlocks:
+        canonicalBlock = {
+            'type': block['type'],
+            'params': [normalizeParam(p) for p in block.get('constructorParams', [])],
+            'inputs': canonicalInputs(block['inputs']),
+        }
+        if 'rate' in block:
+            canonicalBlock['rate'] = block['rate']
+        if block.get('essential', True) is False:
+            canonicalBlock['essential'] = False
+        canonicalBlocks.append(canonicalBlock)
+    canonical = {'blocks': canonicalBlocks, 'physicalOut': canonicalInputs(jsonData['physicalOut'])}
+    if jsonData.get('degradation'):
+        canonical['degradation'] = sorted(jsonData['degradation'])
+    if jsonData.get('profile'):
+        canonical['profile'] = True
+    if jsonData.get('scope'):
+        canonical['scope'] = canonicalInputs({'scope': jsonData['scope']})['scope']
+    # Only if not the default, a patch that spells the default out is the same
+    if getSampleRate(jsonData) != DEFAULT_SAMPLE_RATE:
+        canonical['sampleRate'] = getSampleRate(jsonData)
+    if getBlockSize(jsonData) != DEFAULT_BLOCK_SIZE:
+        canonical['blockSize'] = getBlockSize(jsonData)
+    return canonical
+
+"""
+Returns a hash of the toolchain, the code generator, the template and the prebuilt libraries
+"""
+def getBuildVersion() -> str:
+    h = hashlib.sha256()
+    try:
+        h.update(subprocess.run(['arm-none-eabi-gcc', '--version'], capture_output=True).stdout)
+    except OSError:
+        h.update(b'no toolchain')
+    paths = list(VERSION_FILES)
+    for directory in VERSION_DIRS:
+        paths += sorted(os.path.join(root, name) for root, _, files in os.walk(directory) if 'build' not in root.split(os.sep) for name in files)
+    for path in paths:
+        h.update(path.encode())
+        if os.path.exists(path):
+            with open(path, 'rb') as f:
+                h.update(f.read())
+    return h.hexdigest()
+
+"""
+Content-addressed cache of compiled binaries, keyed on the canonical graph and the build version.
+The binaries are stored in CACHE_DIR and survive restarts, hits and misses are counted for getStats().
+"""
+class FirmwareCache:
+    def __init__(self, cacheDir=CACHE_DIR, size=CACHE_SIZE):
+        self.cacheDir = cacheDir
+        self.size = size
+        self.buildVersion = getBuildVersion()
+        self.entries = OrderedDict()
+        self.hits = 0
+        self.misses = 0
+        self.lock = threading.Lock()
+        os.makedirs(cacheDir, exist_ok=True)
+        # Restore the binaries of earlier runs, oldest first
+        files = [x for x in os.listdir(cacheDir) if x.endswith('.bin')]
+        for name in sorted(files, key=lambda x: os.path.getmtime(os.path.join(cacheDir, x))):
+            self.entries[name[:-len('.bin')]] = os.path.join(cacheDir, name)
+
+    def getKey(self, jsonData) -> str:
+        canonical = json.dumps(canonicalizeGraph(jsonData), sort_keys=True, separators=(',', ':'))
+        return hashlib.sha256((self.buildVersion + canonical).encode()).hexdigest()
+
+    # Key of the topology of a generated Main.cpp: binaries that share it only differ in their parameter table.
+    # A build with the profiler is another topology of the same source
+    def getTopologyKey(self, sourcePath, profile=False) -> str:
+        with open(sourcePath, 'rb') as f:
+            return hashlib.sha256(self.buildVersion.encode() + (b'profile' if profile else b'topology') + f.read()).hexdigest()
+
+    # Returns the binary for key, or None
+    def get(self, key):
+        with self.lock:
+            if key not in self.entries:
+                self.misses += 1
+                return None
+            self.entries.move_to_end(key)
+            self.hits += 1
+            with open(self.entries[key], 'rb') as f:
+                return f.read()
+
+    def put(self, key, binaryPath):
+        with open(binaryPath, 'rb') as f:
+            self.putBinary(key, f.read())
+
+    def putBinary(self, key, binary):
+        path = os.path.join(self.cacheDir, f'{key}.bin')
+        with self.lock:
+            with open(path, 'wb') as f:
+                f.write(binary)
+            self.entries[key] = path
+            self.entries.move_to_end(key)
+            while len(self.entries) > self.size:
+                _, evicted = self.entries.popitem(last=False)
+                os.remove(evicted)
+
+    def getStats(self):
+        with self.lock:
+            return {'entries': len(self.entries), 'size': self.size, 'hits': self.hits, 'misses': self.misses}
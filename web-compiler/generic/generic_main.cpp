@@ -0,0 +1,249 @@
+#include <cstdio>
+#include <cstring>
+#include "daisysp.h"
+#include "Dubby.h"
+#include "DspBlock.h"
+#include "ParamQueue.h"
+#include "PatchLoader.h"
+
+/**
+ * Generic firmware: contains every DspBlock and plays binary patches (../codegen/patch_binary.py) with the PatchLoader.
+ * The last patch is kept in QSPI flash and loaded at boot. A new one is received over USB CDC, loaded and,
+ * if it is valid, stored in place of the old one. The result is sent back as one line of text.
+ */
+
+// Where the patch is kept, relative to the start of the QSPI flash. Erased in 4K sectors
+#define PATCH_QSPI_OFFSET 0
+#define PATCH_MAX_SIZE (16 * 1024)
+// Delay lines of the patch, in the SDRAM
+#define DELAY_MEMORY_SIZE (16 * 1024 * 1024)
+// A partial upload is dropped after this long without data, the rest of a rejected one until then
+#define PATCH_RX_TIMEOUT_MS 500
+
+using namespace daisy;
+using namespace daisysp;
+using namespace dspblock;
+
+Dubby dubby;
+
+ParamQueue paramQueue;
+PatchLoader loader;
+
+// Written by the USB receive callback, read by the main loop once a whole patch is there
+static uint8_t rxBuffer[PATCH_MAX_SIZE];
+static volatile size_t rxSize = 0;
+static volatile uint32_t rxLastTime = 0;
+static volatile bool rxOverflow = false;
+// After an error, until PATCH_RX_TIMEOUT_MS pass without data
+static volatile bool rxDiscarding = false;
+
+static uint64_t DSY_SDRAM_BSS delayMemory[DELAY_MEMORY_SIZE / 8];
+
+void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+{
+    dubby.overruns.OnBlockStart();
+    paramQueue.Drain();
+
+    for(int i = 0; i < 4; i++)
+    {
+        loader.WriteInput(in[i], i);
+    }
+
+    loader.Process();
+
+	for (size_t i = 0; i < size; i++)
+	{
+        for (int j = 0; j < 4; j++)
+        {
+            float * output = loader.GetOutput(j);
+            out[j][i] = output == nullptr ? 0.f : output[i] * 0.25;
+        }
+	}
+
+    dubby.metering.WriteMeters(out, size);
+    dubby.metering.WriteScope(size);
+    dubby.overruns.OnBlockEnd();
+}
+
+// Runs in the USB interrupt, only appends to rxBuffer
+static void UsbReceive(uint8_t * buff, uint32_t * len)
+{
+    rxLastTime = System::GetNow();
+    if (rxDiscarding)
+    {
+        return;
+    }
+    if (rxSize + *len > PATCH_MAX_SIZE)
+    {
+        rxOverflow = true;
+        return;
+    }
+    memcpy(rxBuffer + rxSize, buff, *len);
+    rxSize = rxSize + *len;
+}
+
+// Removes the first consumed bytes from rxBuffer, what UsbReceive appended after them stays.
+// With discard everything is dropped, and so is the rest of the upload until PATCH_RX_TIMEOUT_MS pass without data.
+// The USB interrupt is blocked meanwhile, so it can not append to the part that is dropped
+static void ConsumeUpload(size_t consumed, bool discard)
+{
+    ScopedIrqBlocker irq;
+    size_t remaining = discard || consumed > rxSize ? 0 : rxSize - consumed;
+    memmove(rxBuffer, rxBuffer + rxSize - remaining, remaining);
+    rxSize = remaining;
+    rxOverflow = false;
+    rxDiscarding = discard;
+}
+
+// The size the patch in rxBuffer announces in its header, 0 while the header is incomplete
+static size_t GetExpectedSize()
+{
+    if (rxSize < sizeof(patchformat::PatchHeader))
+    {
+        return 0;
+    }
+    patchformat::PatchHeader header;
+    memcpy(&header, rxBuffer, sizeof(header));
+    return header.size;
+}
+
+// One transmission per line, a second one may be dropped while the first is still being sent
+static void Reply(const char * status, const char * message = "")
+{
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%s%s\r\n", status, message);
+    dubby.seed.usb_handle.TransmitInternal((uint8_t *)line, length);
+}
+
+// The SAI setting of a sample rate PatchLoader::IsSupported()
+static SaiHandle::Config::SampleRate GetSaiSampleRate(uint32_t sampleRate)
+{
+    switch (sampleRate)
+    {
+        case 32000: return SaiHandle::Config::SampleRate::SAI_32KHZ;
+        case 96000: return SaiHandle::Config::SampleRate::SAI_96KHZ;
+        default: return SaiHandle::Config::SampleRate::SAI_48KHZ;
+    }
+}
+
+// Replaces the running patch, the audio is stopped meanwhile so Process() never sees a half loaded patch.
+// The audio is restarted with the sample rate and block size of the new patch
+static PatchLoader::Result LoadPatch(const uint8_t * data, size_t size)
+{
+    dubby.seed.StopAudio();
+    PatchLoader::Result result = loader.Load(data, size, dubby);
+    if (result == PatchLoader::Result::OK)
+    {
+        dubby.seed.SetAudioBlockSize(loader.GetBlockSize());
+        dubby.seed.SetAudioSampleRate(GetSaiSampleRate(loader.GetSampleRate()));
+        dubby.overruns.Init(dubby.seed.AudioSampleRate(), loader.GetBlockSize(), false);
+    }
+    dubby.metering.SetScopeSource(loader.GetScopeSource());
+    // Pending events refer to the blocks of the previous patch
+    paramQueue.Init();
+    loader.PostKnobs(paramQueue, dubby);
+    dubby.overruns.OnAudioStart();
+	dubby.seed.StartAudio(AudioCallback);
+    return result;
+}
+
+// Loading checks magic, size and checksum, so an erased or foreign flash simply leaves the loader empty
+static PatchLoader::Result LoadStoredPatch()
+{
+    const uint8_t * stored = (const uint8_t *)dubby.seed.qspi.GetData(PATCH_QSPI_OFFSET);
+    patchformat::PatchHeader header;
+    memcpy(&header, stored, sizeof(header));
+    return LoadPatch(stored, header.size <= PATCH_MAX_SIZE ? header.size : 0);
+}
+
+// Not through PersistentStorage, which keeps copies of a fixed size struct in RAM and on the stack
+static void StorePatch(const uint8_t * data, size_t size)
+{
+    dubby.seed.qspi.Erase(PATCH_QSPI_OFFSET, PATCH_QSPI_OFFSET + PATCH_MAX_SIZE);
+    dubby.seed.qspi.Write(PATCH_QSPI_OFFSET, size, (uint8_t *)data);
+}
+
+static void ProcessUpload()
+{
+    if (rxDiscarding)
+    {
+        ScopedIrqBlocker irq;
+        if (System::GetNow() - rxLastTime >= PATCH_RX_TIMEOUT_MS)
+        {
+            rxDiscarding = false;
+        }
+        return;
+    }
+    size_t received = rxSize;
+    if (received == 0)
+    {
+        return;
+    }
+    size_t expected = GetExpectedSize();
+    if (rxOverflow || expected > PATCH_MAX_SIZE)
+    {
+        // The rest of it is still arriving
+        Reply("ERR patch too large");
+        ConsumeUpload(received, true);
+    }
+    else if (expected == 0 || received < expected)
+    {
+        if (System::GetNow() - rxLastTime < PATCH_RX_TIMEOUT_MS)
+        {
+            return;
+        }
+        // Anything after the timeout starts the next upload
+        Reply("ERR incomplete patch");
+        ConsumeUpload(received, false);
+    }
+    else
+    {
+        // UsbReceive only appends behind the patch meanwhile
+        PatchLoader::Result result = LoadPatch(rxBuffer, expected);
+        if (result == PatchLoader::Result::OK)
+        {
+            StorePatch(rxBuffer, expected);
+            Reply("OK");
+        }
+        else
+        {
+            // Back to the stored patch, the bad one is not kept
+            LoadStoredPatch();
+            Reply("ERR ", PatchLoader::GetResultString(result));
+        }
+        ConsumeUpload(expected, false);
+    }
+}
+
+int main(void)
+{
+	dubby.seed.Init();
+
+    dubby.Init();
+
+	// Until a patch sets its own
+	dubby.seed.SetAudioBlockSize(AUDIO_BLOCK_SIZE); // number of samples handled per callback
+	dubby.seed.SetAudioSampleRate(SaiHandle::Config::SampleRate::SAI_48KHZ);
+    dubby.ProcessAllControls();
+
+    // Only counted, binary patches have no degradation policies
+    dubby.overruns.Init(dubby.seed.AudioSampleRate(), AUDIO_BLOCK_SIZE, false);
+    loader.SetLargeArena(delayMemory, DELAY_MEMORY_SIZE);
+
+    dubby.seed.usb_handle.Init(UsbHandle::FS_INTERNAL);
+    dubby.seed.usb_handle.SetReceiveCallback(UsbReceive, UsbHandle::FS_INTERNAL);
+
+    dubby.DrawLogo();
+    System::Delay(2000);
+
+    LoadStoredPatch();
+    dubby.UpdateMenu(0, false);
+
+	while(1) {
+        dubby.ProcessAllControls();
+        loader.PostKnobs(paramQueue, dubby);
+        ProcessUpload();
+        dubby.UpdateDisplay();
+        dubby.overruns.SendReport(dubby.seed.usb_handle, System::GetNow());
+	}
+}
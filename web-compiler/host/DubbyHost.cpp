@@ -0,0 +1,42 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "DubbyHost.h"
+
+using namespace daisy;
+
+bool Dubby::LoadKnobFile(const char * path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    knobFrames.clear();
+    currentFrame = 0;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream values(line);
+        std::array<float, CTRL_LAST> frame = { 0.f };
+        for (int k = 0; k < CTRL_LAST && values >> frame[k]; k++) {}
+
+        knobFrames.push_back(frame);
+    }
+
+    return true;
+}
+
+void Dubby::ProcessAllControls()
+{
+    if (currentFrame + 1 < knobFrames.size()) currentFrame++;
+}
+
+float Dubby::GetKnobValue(Ctrl k)
+{
+    if (knobFrames.empty()) return 0.f;
+
+    return knobFrames[currentFrame][k];
+}
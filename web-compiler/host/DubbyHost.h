@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "Metering.h"
+
+// Samples per audio callback, the generated renderer defines it per patch before including this
+#ifndef AUDIO_BLOCK_SIZE
+#define AUDIO_BLOCK_SIZE 128
+#endif
+
+/* no special memory sections on the host */
+#define DTCM_MEM_SECTION /* empty */
+#define DSY_SDRAM_BSS /* empty */
+
+namespace daisy
+{
+/**
+ * Stand-in for OverrunMonitor.h. An offline render does not run in real time, so it never overruns.
+ * SetDegraded() renders the patch as the firmware plays it while degraded, if the patch has degradation.
+ */
+class OverrunMonitor
+{
+  public:
+    void Init(float sampleRate, int blockSize, bool degradation) { this->degradation = degradation; }
+
+    // Audio callback: at its beginning
+    void OnBlockStart()
+    {
+        blockCount++;
+        skippingControlRate = IsDegraded() && (blockCount & 1);
+    }
+
+    // Audio callback: at its end
+    void OnBlockEnd() {}
+
+    void SetDegraded(bool degraded) { this->degraded = degraded; }
+
+    // Non-essential blocks are bypassed
+    bool IsDegraded() const { return degradation && degraded; }
+
+    // Control-rate blocks skip this callback
+    bool IsSkippingControlRate() const { return skippingControlRate; }
+
+  private:
+    bool degradation = false;
+    bool degraded = false;
+    unsigned blockCount = 0;
+    bool skippingControlRate = false;
+};
+
+/**
+ * Stand-in for the Dubby hardware when DspBlocks are built for the host (DAISYDUB_HOST).
+ * Only the parts used by DspBlock and the render template are provided.
+ * Knob values are read from a text file with one line per audio block:
+ *   knob1 knob2 knob3 knob4 [joystick_h joystick_v]
+ * Lines starting with '#' are ignored. The last line is held once the file runs out.
+ */
+class Dubby
+{
+  public:
+    enum Ctrl
+    {
+        CTRL_1,   // knob 1
+        CTRL_2,   // knob 2
+        CTRL_3,   // knob 3
+        CTRL_4,   // knob 4
+        CTRL_5,   // joystick horizontal
+        CTRL_6,   // joystick vertical
+        CTRL_LAST
+    };
+
+    Dubby() {}
+
+    ~Dubby() {}
+
+    // Returns false if the file could not be opened
+    bool LoadKnobFile(const char * path);
+
+    // Moves on to the next line of the knob file, call it once per audio block
+    void ProcessAllControls();
+
+    float GetKnobValue(Ctrl k);
+
+    Metering metering;
+    OverrunMonitor overruns;
+
+  private:
+    std::vector<std::array<float, CTRL_LAST>> knobFrames;
+    size_t currentFrame = 0;
+};
+
+}
@@ -0,0 +1,64 @@
+#include "WavWriter.h"
+
+static void write32(FILE * f, uint32_t v) { fwrite(&v, 4, 1, f); }
+static void write16(FILE * f, uint16_t v) { fwrite(&v, 2, 1, f); }
+
+bool WavWriter::Open(const char * path, int numChannels, int sampleRate)
+{
+    file = fopen(path, "wb");
+    if (file == nullptr) return false;
+
+    this->numChannels = numChannels;
+    this->sampleRate = sampleRate;
+    this->framesWritten = 0;
+
+    WriteHeader();
+    return true;
+}
+
+void WavWriter::WriteBlock(const float * const * channels, size_t numSamples)
+{
+    if (file == nullptr) return;
+
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        for (int ch = 0; ch < numChannels; ch++)
+        {
+            fwrite(&channels[ch][i], sizeof(float), 1, file);
+        }
+    }
+    framesWritten += numSamples;
+}
+
+void WavWriter::Close()
+{
+    if (file == nullptr) return;
+
+    // Rewrite the header now that the data size is known
+    fseek(file, 0, SEEK_SET);
+    WriteHeader();
+    fclose(file);
+    file = nullptr;
+}
+
+// Canonical 44 byte header, format 3 = IEEE float (little endian hosts only)
+void WavWriter::WriteHeader()
+{
+    uint32_t dataBytes = framesWritten * numChannels * sizeof(float);
+
+    fwrite("RIFF", 1, 4, file);
+    write32(file, 36 + dataBytes);
+    fwrite("WAVE", 1, 4, file);
+
+    fwrite("fmt ", 1, 4, file);
+    write32(file, 16);
+    write16(file, 3);
+    write16(file, numChannels);
+    write32(file, sampleRate);
+    write32(file, sampleRate * numChannels * sizeof(float));
+    write16(file, numChannels * sizeof(float));
+    write16(file, 32);
+
+    fwrite("data", 1, 4, file);
+    write32(file, dataBytes);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Minimal writer for interleaved 32-bit float WAV files.
+ * The header is patched with the final sizes on Close().
+ */
+class WavWriter
+{
+  public:
+    WavWriter() {}
+
+    ~WavWriter() { Close(); }
+
+    // Returns false if the file could not be created
+    bool Open(const char * path, int numChannels, int sampleRate);
+
+    // Appends one block of non-interleaved channels, each with numSamples samples
+    void WriteBlock(const float * const * channels, size_t numSamples);
+
+    void Close();
+
+  private:
+    void WriteHeader();
+
+    FILE * file = nullptr;
+    int numChannels = 0;
+    int sampleRate = 0;
+    uint32_t framesWritten = 0;
+};
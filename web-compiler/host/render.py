@@ -0,0 +1,76 @@
+## Requires Python3 !
+"""
+Renders a patch offline on the host, without a Dubby.
+
+Takes the same JSON as codegen/cpp_parse.py::genCpp, generates Render.cpp from render.cpp.template,
+builds it against the host stub of Dubby (see Makefile) and renders the given amount of seconds
+to a 4-channel float WAV file as fast as possible. Per-block ns/sample are printed to stdout.
+
+With --interpreted the patch is serialized with codegen/patch_binary.py instead and played by the PatchLoader,
+like the generic firmware does. Nothing is generated or compiled per patch then, and blocks are not timed.
+
+With --degraded the generated renderer plays the patch as the firmware does while its "degradation" is active.
+
+Usage: python3 render.py patch.json out.wav [-s seconds] [-k knobs.txt] [--no-profile] [--interpreted] [--degraded]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+HOST_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.dirname(HOST_DIR))
+
+from codegen.cpp_parse import genSource
+from codegen.patch_binary import genPatchBinary
+
+def buildRenderer(jsonData, patchDir):
+    if not os.path.exists(patchDir):
+        os.makedirs(patchDir)
+    genSource(jsonData, os.path.join(HOST_DIR, 'render.cpp.template'), os.path.join(patchDir, 'Render.cpp'))
+    subprocess.run(['make', '-s', f'-j{os.cpu_count()}', f'PATCH_DIR={patchDir}'], cwd=HOST_DIR, check=True)
+    return os.path.join(patchDir, 'Render')
+
+def buildPatchRenderer(jsonData, patchDir):
+    if not os.path.exists(patchDir):
+        os.makedirs(patchDir)
+    patchPath = os.path.join(patchDir, 'patch.ddp')
+    with open(patchPath, 'wb') as f:
+        f.write(genPatchBinary(jsonData))
+    subprocess.run(['make', '-s', f'-j{os.cpu_count()}', 'render_patch'], cwd=HOST_DIR, check=True)
+    return os.path.join(HOST_DIR, 'build', 'RenderPatch'), patchPath
+
+def main():
+    parser = argparse.ArgumentParser(description='Render a DspBlock patch to WAV on the host')
+    parser.add_argument('patch', help='patch JSON, as posted to /compiler')
+    parser.add_argument('out', help='WAV file to write')
+    parser.add_argument('-s', '--seconds', type=float, default=10.0)
+    parser.add_argument('-k', '--knobs', help='knob file, one line of knob values per audio block')
+    parser.add_argument('--no-profile', action='store_true', help='do not time individual blocks')
+    parser.add_argument('--degraded', action='store_true', help='bypass non-essential blocks and skip control-rate ones every other callback')
+    parser.add_argument('--interpreted', action='store_true', help='play a binary patch with the PatchLoader instead of generating code')
+    parser.add_argument('--build-dir', default=os.path.join(HOST_DIR, 'build', 'patch'))
+    args = parser.parse_args()
+
+    with open(args.patch) as f:
+        jsonData = json.load(f)
+
+    if args.interpreted:
+        renderer, patchPath = buildPatchRenderer(jsonData, os.path.abspath(args.build_dir))
+        cmd = [renderer, '-p', patchPath]
+    else:
+        cmd = [buildRenderer(jsonData, os.path.abspath(args.build_dir))]
+        if args.no_profile:
+            cmd.append('-n')
+        if args.degraded:
+            cmd.append('-d')
+
+    cmd += ['-o', os.path.abspath(args.out), '-s', str(args.seconds)]
+    if args.knobs:
+        cmd += ['-k', os.path.abspath(args.knobs)]
+    return subprocess.run(cmd).returncode
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,149 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "daisysp.h"
+#include "DubbyHost.h"
+#include "DspBlock.h"
+#include "ParamQueue.h"
+#include "PatchLoader.h"
+#include "WavWriter.h"
+
+/**
+ * Renders a binary patch (see codegen/patch_binary.py) with the PatchLoader, like the generic firmware plays it,
+ * at the sample rate and block size of the patch.
+ * The output matches the one of the generated renderer (render.cpp.template) for the same JSON.
+ */
+
+// Keep in sync with generic_main.cpp
+#define DELAY_MEMORY_SIZE (16 * 1024 * 1024)
+
+using namespace daisy;
+using namespace dspblock;
+
+Dubby dubby;
+ParamQueue paramQueue;
+PatchLoader loader;
+
+static float * EMPTY_BUFFER;
+static uint64_t delayMemory[DELAY_MEMORY_SIZE / 8];
+
+void AudioCallback(float ** out, size_t size)
+{
+    paramQueue.Drain();
+
+    for(int i = 0; i < 4; i++)
+    {
+        loader.WriteInput(EMPTY_BUFFER, i);
+    }
+
+    loader.Process();
+
+	for (size_t i = 0; i < size; i++)
+	{
+        for (int j = 0; j < 4; j++)
+        {
+            float * output = loader.GetOutput(j);
+            out[j][i] = output == nullptr ? 0.f : output[i] * 0.25;
+        }
+	}
+
+    dubby.metering.WriteMeters(out, size);
+    dubby.metering.WriteScope(size);
+}
+
+static void printUsage(const char * name)
+{
+    fprintf(stderr, "usage: %s -p patch.ddp -o out.wav [-s seconds] [-k knobs.txt]\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * patchPath = nullptr;
+    const char * outPath = nullptr;
+    const char * knobPath = nullptr;
+    float seconds = 10.f;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (!strcmp(argv[a], "-p") && a + 1 < argc) patchPath = argv[++a];
+        else if (!strcmp(argv[a], "-o") && a + 1 < argc) outPath = argv[++a];
+        else if (!strcmp(argv[a], "-k") && a + 1 < argc) knobPath = argv[++a];
+        else if (!strcmp(argv[a], "-s") && a + 1 < argc) seconds = atof(argv[++a]);
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (patchPath == nullptr || outPath == nullptr)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (knobPath != nullptr && !dubby.LoadKnobFile(knobPath))
+    {
+        fprintf(stderr, "could not read knob file %s\n", knobPath);
+        return 1;
+    }
+
+    FILE * patchFile = fopen(patchPath, "rb");
+    if (patchFile == nullptr)
+    {
+        fprintf(stderr, "could not read patch %s\n", patchPath);
+        return 1;
+    }
+    std::vector<uint8_t> patch;
+    uint8_t chunk[1024];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), patchFile)) > 0)
+    {
+        patch.insert(patch.end(), chunk, chunk + read);
+    }
+    fclose(patchFile);
+
+    loader.SetLargeArena(delayMemory, DELAY_MEMORY_SIZE);
+    PatchLoader::Result result = loader.Load(patch.data(), patch.size(), dubby);
+    dubby.metering.SetScopeSource(loader.GetScopeSource());
+    if (result != PatchLoader::Result::OK)
+    {
+        fprintf(stderr, "could not load %s: %s\n", patchPath, PatchLoader::GetResultString(result));
+        return 1;
+    }
+    paramQueue.Init();
+    loader.PostKnobs(paramQueue, dubby);
+
+    const uint32_t sampleRate = loader.GetSampleRate();
+    const size_t blockSize = loader.GetBlockSize();
+    WavWriter wav;
+    if (!wav.Open(outPath, 4, sampleRate))
+    {
+        fprintf(stderr, "could not create %s\n", outPath);
+        return 1;
+    }
+
+    EMPTY_BUFFER = new float[blockSize]();
+    float * out[4];
+    for (int j = 0; j < 4; j++) out[j] = new float[blockSize]();
+
+    size_t numBlocks = (size_t)(seconds * sampleRate) / blockSize;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < numBlocks; n++)
+    {
+        AudioCallback(out, blockSize);
+        wav.WriteBlock(out, blockSize);
+        dubby.ProcessAllControls();
+        loader.PostKnobs(paramQueue, dubby);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    wav.Close();
+
+    double totalNs = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    double renderedSamples = (double)numBlocks * blockSize;
+    printf("# %d blocks loaded into %zu bytes of arena and %zu bytes of delay lines, %zu blocks of %zu samples, %.3f s rendered in %.3f s (%.1fx realtime)\n",
+           loader.GetNumNodes(), loader.GetArenaUsed(), loader.GetLargeArenaUsed(), numBlocks, blockSize, renderedSamples / sampleRate,
+           totalNs * 1e-9, (renderedSamples / sampleRate) / (totalNs * 1e-9));
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+namespace daisy
+{
+/**
+ * Host stand-in for libDaisy's System class (sys/system.h).
+ * Only the tick timer is provided, so that timing helpers like util/CpuLoadMeter.h build unchanged.
+ * One tick is one nanosecond of std::chrono::steady_clock.
+ */
+class System
+{
+  public:
+    /** \return the lower 32 bits of the steady clock in nanoseconds */
+    static uint32_t GetTick()
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+
+    /** Returns the tick rate in Hz with which GetTick() is incremented. */
+    static uint32_t GetTickFreq() { return 1000000000; }
+};
+
+}
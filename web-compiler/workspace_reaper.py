@@ -0,0 +1,59 @@
+## Requires Python3 !
+
+import os
+import time
+import shutil
+import threading
+
+# Defaults, overridden by the environment variables of the same name
+BUILDSPACE_MAX_AGE = int(os.environ.get('BUILDSPACE_MAX_AGE', 3600))                  # seconds
+BUILDSPACE_QUOTA = int(os.environ.get('BUILDSPACE_QUOTA_MB', 1024)) * 1024 * 1024     # bytes
+REAP_INTERVAL = int(os.environ.get('REAP_INTERVAL', 60))                              # seconds
+
+"""
+Returns the size of the files in a directory, symlinks are not followed
+"""
+def getDirectorySize(path) -> int:
+    size = 0
+    for root, _, files in os.walk(path):
+        for name in files:
+            filePath = os.path.join(root, name)
+            if not os.path.islink(filePath):
+                size += os.path.getsize(filePath)
+    return size
+
+"""
+Deletes the request workspaces in buildspace (every directory, the template file stays) that are older than maxAge,
+then the oldest ones until the rest fits into quota. Workspaces for which isActive(name) is true are kept.
+Returns the names of the deleted workspaces.
+"""
+def reapWorkspaces(buildspace, maxAge=BUILDSPACE_MAX_AGE, quota=BUILDSPACE_QUOTA, isActive=lambda name: False):
+    workspaces = []
+    for name in os.listdir(buildspace):
+        path = os.path.join(buildspace, name)
+        if os.path.isdir(path) and not os.path.islink(path) and not isActive(name):
+            workspaces.append((os.path.getmtime(path), getDirectorySize(path), name))
+    workspaces.sort()
+
+    now = time.time()
+    total = sum(x[1] for x in workspaces)
+    reaped = []
+    for modified, size, name in workspaces:
+        if now - modified <= maxAge and total <= quota:
+            break
+        shutil.rmtree(os.path.join(buildspace, name), ignore_errors=True)
+        total -= size
+        reaped.append(name)
+    return reaped
+
+"""
+Runs reapWorkspaces every interval seconds on a background thread
+"""
+def startReaper(buildspace, isActive, interval=REAP_INTERVAL, maxAge=BUILDSPACE_MAX_AGE, quota=BUILDSPACE_QUOTA):
+    def reap():
+        while True:
+            reapWorkspaces(buildspace, maxAge, quota, isActive)
+            time.sleep(interval)
+    thread = threading.Thread(target=reap, daemon=True)
+    thread.start()
+    return thread
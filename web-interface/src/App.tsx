@@ -91,7 +91,7 @@ function App() {
 async function btnFlashClick(editor: any, callback: any) {
   if (editor?.getFlow) {
     let reqBody = editor.getFlow();
-    await bigFlash(reqBody, 'http://localhost:5000/compiler', callback);
+    await bigFlash(reqBody, 'http://localhost:5000', callback);
   }
 }
 
@@ -1343,27 +1343,64 @@ async function connect(device: any) {
     return device;
 }
 
-async function downloadServerFirmwareFile(path: any, data: any)
+// Follows the events of a compile job until it is finished, resolves with the job
+function followCompileJob(server: any, jobId: any)
     {
         return new Promise((resolve) => {
-            let buffer;
-            let raw = new XMLHttpRequest();
-            let fname = path;
-            console.log(path)
-            raw.open("POST", fname, true);
-            raw.responseType = "arraybuffer"
-            raw.setRequestHeader("Content-Type", "application/json;charset=UTF-8");
-            raw.onreadystatechange = function ()
-            {
-                if (this.readyState === 4 && this.status === 200) {
-                    resolve(this.response)
-                }    
-            }
-            raw.send(JSON.stringify(data))
+            let events = new EventSource(server + "/jobs/" + jobId + "/events");
+            events.addEventListener("phase", (e: any) => {
+                log("Compiler: " + JSON.parse(e.data) + "...");
+            });
+            events.addEventListener("diagnostic", (e: any) => {
+                let diagnostic = JSON.parse(e.data);
+                let node = diagnostic.nodeId ? " in node " + diagnostic.nodeId : "";
+                log(diagnostic.severity + node + ": " + diagnostic.message);
+            });
+            events.addEventListener("status", (e: any) => {
+                events.close();
+                resolve(JSON.parse(e.data));
+            });
+            events.onerror = () => {
+                events.close();
+                resolve({ status: "failed", error: "Lost connection to the compiler" });
+            };
         })
     }
 
-export async function bigFlash(flow: any, path: any, callback: any) {
+// Submits the flow as a compile job, returns the binary or null if the build failed
+async function downloadServerFirmwareFile(server: any, data: any)
+    {
+        let response = await fetch(server + "/jobs", {
+            method: "POST",
+            headers: { "Content-Type": "application/json;charset=UTF-8" },
+            body: JSON.stringify(data)
+        });
+        if (response.status === 429) {
+            log("The compiler is busy, please retry in " + response.headers.get("Retry-After") + "s");
+            return null;
+        }
+        if (response.status === 422) {
+            log("Patch rejected: " + (await response.json()).error);
+            return null;
+        }
+        if (!response.ok) {
+            log("Compiler error: " + await response.text());
+            return null;
+        }
+        let job = await response.json();
+        if (job.estimate) {
+            log("Estimated CPU load " + Math.round(job.estimate.cpuLoad * 100) + "%, " + (job.estimate.sramUpperBound ? "up to " : "") + Math.ceil(job.estimate.sramBytes / 1024) + " KB SRAM");
+        }
+        let status: any = await followCompileJob(server, job.id);
+        if (status.status !== "done") {
+            log("Build failed: " + status.error);
+            return null;
+        }
+        let binary = await fetch(server + "/jobs/" + job.id + "/binary");
+        return binary.ok ? await binary.arrayBuffer() : null;
+    }
+
+export async function bigFlash(flow: any, server: any, callback: any) {
     
     let filters = [];
     if (serial) {
@@ -1403,7 +1440,7 @@ export async function bigFlash(flow: any, path: any, callback: any) {
         // flashing
         let firmwareFile: any; // our binaries
         log("Generating code and compiling...")
-        await downloadServerFirmwareFile(path, flow).then(buffer => {
+        await downloadServerFirmwareFile(server, flow).then(buffer => {
             firmwareFile = buffer
         });
 
@@ -98,6 +98,19 @@ export class FeedbackDelayNode extends Node {
   }
 }
 
+// one block delay (z^-1)
+// outputs its input of the previous audio block, the only way to route a signal back into an earlier node
+export class BlockDelayNode extends Node {
+  width = 180;
+  height = 140;
+  type = "BlockDelay";
+  constructor() {
+    super('Block Delay');
+    this.addInput('0', new ClassicPreset.Input(socket, 'Audio In'));
+    this.addOutput('0', new ClassicPreset.Output(socket, 'Output'));
+  }
+}
+
 
 // adder node
 // equivalent to a 2 channel mixer with no gain control
@@ -244,4 +257,24 @@ export class CompressorNode extends Node {
   }
 }
 
+export class MBCompressorNode extends Node {
+  width = 180;
+  height = 260;
+  type = "MBCompressor";
+  constructor(bandAmount: number) {
+    super(`Multiband Compressor (${bandAmount} bands)`);
+    this.addInput('0', new ClassicPreset.Input(socket, 'In'));
+    for (let i = 1; i < bandAmount; i++) {
+      this.addInput(i.toString(), new ClassicPreset.Input(socket, `Crossover ${i} [Hz]`));
+      this.height += 22;
+    }
+    this.addInput(bandAmount.toString(), new ClassicPreset.Input(socket, 'Threshold [dB]'));
+    this.addInput((bandAmount + 1).toString(), new ClassicPreset.Input(socket, 'Ratio [1-40]'));
+    this.addInput((bandAmount + 2).toString(), new ClassicPreset.Input(socket, 'Attack [10-0.001]'));
+    this.addInput((bandAmount + 3).toString(), new ClassicPreset.Input(socket, 'Release [10-0.001]'));
+    this.addControl('0', new ClassicPreset.InputControl('number', { initial: bandAmount, readonly: true }));
+    this.addOutput('0', new ClassicPreset.Output(socket, 'Out'));
+  }
+}
+
 export const dubbyOuts = new DubbyAudioOutputsNode();
\ No newline at end of file
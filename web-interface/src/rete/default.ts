@@ -76,6 +76,7 @@ export async function createEditor(container: HTMLElement) {
       ['Number', () => new Custom.NumberNode()],
       ['Oscillator', () => new Custom.OscillatorNode()],
       ['Feedback Delay', () => new Custom.FeedbackDelayNode()],
+      ['Block Delay', () => new Custom.BlockDelayNode()],
       ['Filter', [
         ['Lowpass', () => new Custom.FilterNode('lowpass')],
         ['Bandpas', () => new Custom.FilterNode('bandpass')],
@@ -110,6 +111,11 @@ export async function createEditor(container: HTMLElement) {
       ]],
       ['Unipolarise', () => new Custom.UnipolarsiserNode()],
       ['Compressor', () => new Custom.CompressorNode()],
+      ['Multiband Compressor', [
+        ['2 Bands', () => new Custom.MBCompressorNode(2)],
+        ['3 Bands', () => new Custom.MBCompressorNode(3)],
+        ['4 Bands', () => new Custom.MBCompressorNode(4)],
+      ]],
       ['Noise', () => new Custom.NoiseNode()]
     ]),
   });